@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+// Number of heap allocations (operator new) made by the calling thread so far.
+// Backed by the global operator new replacement in AllocCounter.cpp, which is only
+// built with COUNT_ALLOCS defined; otherwise this is always 0.
+size_t threadAllocations();
+
+#ifdef COUNT_ALLOCS
+constexpr bool ALLOCATIONS_COUNTED = true;
+#else
+constexpr bool ALLOCATIONS_COUNTED = false;
+#endif
@@ -2,25 +2,119 @@
 
 #include <string>
 #include <iostream>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <chrono>
 #include <boost/asio.hpp>
 
 using boost::asio::ip::tcp;
 
 class ConnectionHandler {
+public:
+	// Called for every frame read in async mode. Return false to stop reading.
+	typedef std::function<bool(std::string &)> FrameHandler;
+	// Called once when the connection is lost in async mode.
+	typedef std::function<void()> CloseHandler;
+	// How frames are told apart on the wire: by the delimiter passed to each call, or by a
+	// 4-byte big-endian length in front of every frame (only once both sides agreed to it).
+	enum class Framing { Delimited, LengthPrefixed };
+	// Longest frame accepted in LengthPrefixed mode.
+	static const uint32_t MAX_FRAME_LENGTH = 16 << 20;
+
 private:
 	const std::string host_;
 	const short port_;
-	boost::asio::io_service io_service_;   // Provides core I/O functionality
+	boost::asio::io_service ownIoService_;  // Used when no shared io_service is supplied
+	boost::asio::io_service &io_service_;   // Provides core I/O functionality
 	tcp::socket socket_;
+	std::vector<char> inBuf_;              // Receive buffer, filled by large read_some calls
+	size_t inStart_;                       // First unconsumed byte in inBuf_
+	size_t inEnd_;                         // One past the last buffered byte in inBuf_
+	size_t readCalls_;                     // Number of read_some calls issued so far
+	std::atomic<Framing> framing_;
+	std::chrono::milliseconds connectTimeout_;  // Deadlines of the blocking calls, zero for none
+	std::chrono::milliseconds recvTimeout_;
+	std::chrono::milliseconds sendTimeout_;
+
+	// Async mode state. Everything below except asyncMode_/asyncClosed_ is only
+	// touched from handlers running on strand_.
+	boost::asio::io_service::strand strand_;
+	boost::asio::streambuf asyncIn_;
+	std::string asyncFrame_;               // Reused for every frame so reading does not allocate
+	std::deque<std::string> outQueue_;     // Outbound frames, front one is being written
+	std::atomic<bool> asyncMode_;
+	std::atomic<bool> asyncClosed_;
+	char asyncDelimiter_;
+	FrameHandler onFrame_;
+	CloseHandler onClose_;
+	typedef std::chrono::steady_clock Clock;
+	boost::asio::steady_timer heartbeatTimer_;
+	std::chrono::milliseconds sendInterval_;   // Zero: no heart-beats are sent
+	std::chrono::milliseconds readTimeout_;    // Zero: no read deadline
+	Clock::time_point lastSend_;
+	Clock::time_point lastReceive_;
+
+	// Run the io_service one handler at a time until the async operation just started sets
+	// done, or until timeout, in which case the socket is closed. Returns false on timeout.
+	bool awaitOperation(const bool &done, std::chrono::milliseconds timeout);
+	// Blocking socket calls, made as async operations with a deadline when a timeout is set.
+	size_t readSome(const boost::asio::mutable_buffer &buffer, boost::system::error_code &error);
+	size_t writeAll(const std::vector<boost::asio::const_buffer> &buffers, boost::system::error_code &error);
+
+	// Refill the receive buffer with a single read_some call.
+	// Returns false in case the connection is closed or an error occurs.
+	bool fillBuffer();
+
+	// Write a whole buffer sequence to the socket - blocking.
+	// Returns false in case the connection is closed before all the data is sent.
+	bool sendBuffers(const std::vector<boost::asio::const_buffer> &buffers);
+	bool sendFramesBlocking(const std::vector<std::string> &frames, char delimiter);
+
+	// LengthPrefixed counterpart of getFrameAscii: reads the prefix, then exactly that many bytes.
+	bool getFramePrefixed(std::string &frame);
+	static uint32_t getLength(const char prefix[4]);
+	static void putLength(char prefix[4], size_t length);
+
+	// Async mode helpers, all run on strand_.
+	void asyncReadFrame();
+	void onAsyncRead(const boost::system::error_code &error, size_t length);
+	void scheduleHeartbeat();
+	void enqueueAsync(std::string data);
+	void writeAsync(std::string data);
+	void asyncWriteNext();
+	void finishAsync(bool lost);
 
 public:
+	static const size_t RECV_BUFFER_SIZE = 1 << 16;
+
 	ConnectionHandler(std::string host, short port);
 
+	// Same as above, but all socket operations run on the given io_service so
+	// that one event loop can drive many connections.
+	ConnectionHandler(std::string host, short port, boost::asio::io_service &io_service);
+
 	virtual ~ConnectionHandler();
 
 	// Connect to the remote machine
 	bool connect();
 
+	// Deadlines for connect and for each blocking read and write, after which the call fails
+	// with timed_out and the connection is closed. Zero, the default, waits forever.
+	// With a timeout set, blocking calls run the io_service, so they must not be mixed with
+	// async mode on a shared io_service. Async mode uses setHeartbeat instead.
+	void setTimeouts(std::chrono::milliseconds connect, std::chrono::milliseconds read,
+	                 std::chrono::milliseconds write);
+
+	// Connect again after an async connection was lost and run() returned. Everything
+	// buffered or queued for the old connection is dropped, framing is back to Delimited,
+	// heart-beating is off and the handler is in blocking mode until startAsync. Until then
+	// sendFrameAscii refuses every frame; the login exchange uses sendWhileResuming.
+	// Restarts the io_service, so only use it on a handler with its own.
+	bool reconnect();
+
 	// Read a fixed number of bytes from the server - blocking.
 	// Returns false in case the connection is closed before bytesToRead bytes can be read.
 	bool getBytes(char bytes[], unsigned int bytesToRead);
@@ -38,14 +132,51 @@ public:
 	bool sendLine(std::string &line);
 
 	// Get Ascii data from the server until the delimiter character
+	// (in LengthPrefixed mode: one whole frame; the delimiter is not used).
 	// Returns false in case connection closed before null can be read.
 	bool getFrameAscii(std::string &frame, char delimiter);
 
 	// Send a message to the remote host.
 	// Returns false in case connection is closed before all the data is sent.
+	// In async mode the frame is queued and the call returns immediately.
 	bool sendFrameAscii(const std::string &frame, char delimiter);
 
+	// Send several messages to the remote host with a single gather write,
+	// each one followed by the delimiter.
+	// Returns false in case connection is closed before all the data is sent.
+	bool sendFrameAscii(const std::vector<std::string> &frames, char delimiter);
+
+	// Blocking send for the thread resuming a session between reconnect and startAsync,
+	// while sendFrameAscii still refuses frames from everyone else.
+	bool sendWhileResuming(const std::vector<std::string> &frames, char delimiter);
+
+	// Switch to async mode: frames ending with the delimiter are read with
+	// async_read_some and handed to onFrame, and sendFrameAscii only queues the
+	// frame for a strand-serialised async_write. Call run() (or run the shared
+	// io_service) to drive the connection.
+	void startAsync(char delimiter, FrameHandler onFrame, CloseHandler onClose);
+
+	// Run the io_service event loop until the async connection is finished.
+	void run();
+
+	// Stop the async connection from any thread, without calling onClose.
+	void stopAsync();
+
+	// Framing for every frame read or sent from now on. In async mode call it from the
+	// frame handler, so the next frame is already read with the new framing.
+	void setFraming(Framing framing);
+	Framing getFraming() const;
+
+	// Keepalive and read deadline for async mode. A heart-beat (an end of line, or an empty
+	// frame once length-prefixed) is sent whenever nothing else was sent for sendInterval, and
+	// the connection is dropped as lost once nothing at all arrived for readTimeout.
+	// Zero disables either one.
+	void setHeartbeat(std::chrono::milliseconds sendInterval, std::chrono::milliseconds readTimeout);
+
 	// Close down the connection properly.
 	void close();
 
+	// Number of read_some calls issued on the socket (used for benchmarking).
+	size_t getReadCalls() const;
+
 }; //class ConnectionHandler
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <chrono>
+#include <initializer_list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+// Console writer shared by the threads that print server output.
+// Received updates can be batched and written by an output thread, so a slow
+// terminal never throttles frame processing.
+class ConsoleOutput
+{
+public:
+    enum class Mode {
+        Immediate,  // Every update is written and flushed as it arrives
+        Buffered,   // Updates are batched and flushed periodically by the output thread
+        Compact,    // Like Buffered, but every update is a single line, and dropped when the terminal falls behind
+        Quiet       // Updates are not shown at all
+    };
+
+    // Pending output that makes the output thread flush early.
+    static constexpr size_t FLUSH_BYTES = 1 << 16;
+    // Pending output past which an update waits for the terminal (Buffered) or is dropped (Compact).
+    static constexpr size_t MAX_PENDING_BYTES = 64 * FLUSH_BYTES;
+
+private:
+    std::ostream& out_;
+    std::atomic<Mode> mode_;
+    std::chrono::milliseconds flushInterval_;
+    std::mutex mutex_;                  // Guards everything below and writes to out_ in Immediate mode
+    std::condition_variable wakeup_;
+    std::condition_variable drained_;   // Signalled when the output thread takes the pending output
+    std::string pending_;               // Output waiting for the output thread
+    size_t dropped_;                    // Compact updates dropped since the last write
+    bool flushNow_;
+    bool stop_;
+    std::thread writer_;                // Only runs in Buffered and Compact modes
+
+    void runWriter();
+    // Says how many updates were dropped since the last note, at the end of pending_.
+    void noteDropped();
+
+public:
+    explicit ConsoleOutput(std::ostream& out);
+    ConsoleOutput(const ConsoleOutput&) = delete;
+    ConsoleOutput& operator=(const ConsoleOutput&) = delete;
+    // Writes out whatever is still pending.
+    ~ConsoleOutput();
+
+    // Call before anything is printed.
+    void setMode(Mode mode, std::chrono::milliseconds flushInterval);
+    Mode mode() const;
+
+    // Output of one received update, given in pieces so nothing has to be concatenated first.
+    // Dropped in Quiet mode, and in Compact mode while MAX_PENDING_BYTES are pending.
+    void update(std::initializer_list<std::string_view> pieces);
+    // A reply the user is waiting for. Always shown, promptly and after any pending updates.
+    void line(std::string_view text);
+
+    // Parses immediate, buffered, compact or quiet. Returns false for anything else.
+    static bool parseMode(const std::string& name, Mode& mode);
+};
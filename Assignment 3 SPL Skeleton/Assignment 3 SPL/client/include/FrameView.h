@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <array>
+#include <utility>
+
+// Non-owning, single-pass view of a received STOMP frame.
+// Every view points into the frame string, which must outlive this object.
+class FrameView
+{
+public:
+    static constexpr size_t MAX_HEADERS = 16;
+
+private:
+    std::string_view command_;
+    std::array<std::pair<std::string_view, std::string_view>, MAX_HEADERS> headers_;
+    size_t headerCount_;
+    std::string_view body_;
+
+public:
+    // Parses the frame. Headers past MAX_HEADERS are ignored.
+    explicit FrameView(std::string_view frame);
+
+    std::string_view command() const;
+    // Value of the first header with this name, or an empty view. Order of the headers does not matter.
+    std::string_view header(std::string_view name) const;
+    bool hasHeader(std::string_view name) const;
+    std::string_view body() const;
+};
+
+// Non-owning view of the fields in a report body, as built by the report command.
+// The single-line fields may appear in any order, but only before the first section header:
+// after it every line up to the next header is an entry of that section. The update sections
+// are the raw "key:value" lines.
+struct ReportBodyView
+{
+    std::string_view user;
+    std::string_view team_a;
+    std::string_view team_b;
+    std::string_view event_name;
+    int time;
+    std::string_view general_updates;
+    std::string_view team_a_updates;
+    std::string_view team_b_updates;
+    std::string_view description;
+
+    explicit ReportBodyView(std::string_view body);
+};
+
+// Strip a trailing '\r' left by CRLF line endings.
+std::string_view trimCR(std::string_view line);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Log-linear latency histogram in the style of HdrHistogram.
+// Values below 32 get a bucket each; above that every power of two is split into
+// 16 buckets, so any recorded value is reported within about 3% over the full 64-bit range.
+// Counters are atomic: one thread can record while another reads percentiles.
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 4;
+    static constexpr size_t LINEAR_BUCKETS = 2 << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKETS = LINEAR_BUCKETS + (64 - SUB_BUCKET_BITS - 1) * (1 << SUB_BUCKET_BITS);
+
+private:
+    std::atomic<uint64_t> counts_[BUCKETS];
+    std::atomic<uint64_t> total_;
+    std::atomic<uint64_t> max_;
+
+    static size_t bucketOf(uint64_t value);
+    // A representative value of the bucket: its midpoint.
+    static uint64_t valueOf(size_t bucket);
+
+public:
+    LatencyHistogram();
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record(uint64_t value);
+    uint64_t count() const;
+    uint64_t max() const;
+    // Smallest recorded value (approximately) that at least fraction p of the records do not exceed.
+    uint64_t percentile(double p) const;
+};
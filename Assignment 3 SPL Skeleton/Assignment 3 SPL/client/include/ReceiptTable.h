@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <memory>
+#include <chrono>
+
+// Frame a receipt was requested for, used to keep latency per command type.
+enum class ReceiptKind { Subscribe, Unsubscribe, Disconnect, Send, Count };
+
+struct PendingReceipt
+{
+    ReceiptKind kind;
+    std::chrono::steady_clock::time_point sentAt;
+    std::string action;
+
+    PendingReceipt() : kind(ReceiptKind::Send), sentAt(), action() {}
+};
+
+// Receipts we are still waiting for, with what to do when each one arrives.
+// Receipt ids are handed out sequentially, so the table is a fixed array, open-addressed
+// from id modulo its capacity with linear probing: no hashing, no locks. A slot is claimed
+// and released with compare-and-swap on its key, and the action is published by the
+// release store of the key. A receipt that never arrives only takes its own slot.
+class ReceiptTable
+{
+public:
+    static constexpr size_t CAPACITY = 1024;
+
+private:
+    static constexpr int EMPTY = -1;
+    static constexpr int BUSY = -2;    // Being filled in or taken
+
+    struct Slot {
+        std::atomic<int> key;
+        PendingReceipt receipt;
+        Slot() : key(EMPTY), receipt() {}
+    };
+    std::unique_ptr<Slot[]> slots_;
+    // Longest probe any insert needed. Lookups probe this far, since taken slots leave
+    // holes that do not end a probe sequence.
+    std::atomic<size_t> maxProbe_;
+
+    Slot& slotAt(int id, size_t probe) const;
+    Slot* find(int id) const;
+
+public:
+    ReceiptTable();
+    ReceiptTable(const ReceiptTable&) = delete;
+    ReceiptTable& operator=(const ReceiptTable&) = delete;
+
+    // Records the receipt as sent now, so call it right before sending the frame.
+    // Returns false if CAPACITY receipts are already outstanding.
+    bool insert(int id, ReceiptKind kind, std::string action);
+    // Removes the receipt and moves it out. Returns false if it is not pending.
+    bool take(int id, PendingReceipt& receipt);
+    bool contains(int id) const;
+    // Forgets every pending receipt with an id below id, e.g. the ones sent on a lost connection.
+    void clearBefore(int id);
+};
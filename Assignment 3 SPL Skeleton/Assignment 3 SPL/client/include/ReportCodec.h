@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Compressed encoding for report bodies, sent as "content-encoding:x-report-lz".
+//
+// LZ77 over a dictionary shared by every client, holding the report layout and common
+// match vocabulary, so even a short report has something to refer back to.
+// The output stays NUL-free valid UTF-8 text so it survives NUL-delimited framing and the
+// server's String handling untouched: literal bytes are copied as is, and a back-reference is
+// MARK followed by three printable ASCII digits (length, offset high, offset low).
+// Back-references never start or end inside a UTF-8 sequence.
+
+constexpr std::string_view REPORT_ENCODING = "x-report-lz";
+
+// Compresses body into out. Returns false if body cannot be encoded (it contains
+// NUL, MARK or '\r') or would not get smaller, in which case it should be sent as is.
+bool compressReportBody(std::string_view body, std::string& out);
+
+// Decodes into out, reusing its capacity. Returns false if encoded is malformed.
+bool decompressReportBody(std::string_view encoded, std::string& out);
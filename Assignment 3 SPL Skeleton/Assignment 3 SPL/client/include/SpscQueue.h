@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Items are swapped in and out of the slots instead of copied, so with std::string
+// the buffers travel back to the producer and a steady stream of frames does not allocate.
+// Only a consumer with nothing to do takes the mutex, to sleep until the next push.
+template <typename T>
+class SpscQueue
+{
+private:
+    std::vector<T> slots_;
+    const size_t mask_;
+    alignas(64) std::atomic<size_t> head_;   // Next slot to pop, written by the consumer only
+    alignas(64) std::atomic<size_t> tail_;   // Next slot to push, written by the producer only
+    alignas(64) std::atomic<bool> closed_;
+    std::atomic<bool> consumerSleeping_;
+    std::mutex sleepMutex_;
+    std::condition_variable wakeup_;
+
+    static size_t roundUp(size_t n) {
+        size_t capacity = 2;
+        while (capacity < n) capacity <<= 1;
+        return capacity;
+    }
+
+    void wakeConsumer() {
+        // Pairs with the fence in pop: either the consumer sees the new tail/closed
+        // before it sleeps, or we see it sleeping and wake it.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumerSleeping_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            wakeup_.notify_one();
+        }
+    }
+
+public:
+    // Capacity is rounded up to a power of two.
+    explicit SpscQueue(size_t capacity) :
+        slots_(roundUp(capacity)), mask_(slots_.size() - 1), head_(0), tail_(0), closed_(false),
+        consumerSleeping_(false), sleepMutex_(), wakeup_() {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer only. Swaps item into the queue, waiting while it is full.
+    // Returns false, leaving item alone, once the queue is closed.
+    bool push(T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        while (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+            if (closed_.load(std::memory_order_acquire)) return false;
+            std::this_thread::yield();
+        }
+        if (closed_.load(std::memory_order_acquire)) return false;
+        std::swap(slots_[tail & mask_], item);
+        tail_.store(tail + 1, std::memory_order_release);
+        wakeConsumer();
+        return true;
+    }
+
+    // Consumer only. Swaps the oldest item into item without waiting.
+    bool tryPop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false;
+        std::swap(item, slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Waits for the next item; returns false when the queue is closed and empty.
+    bool pop(T& item) {
+        while (true) {
+            for (int spin = 0; spin < 64; spin++) {
+                if (tryPop(item)) return true;
+                if (closed_.load(std::memory_order_acquire)) return tryPop(item);
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            consumerSleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire) &&
+                !closed_.load(std::memory_order_acquire)) {
+                wakeup_.wait(lock);
+            }
+            consumerSleeping_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Either side. Items already queued can still be popped; new pushes fail.
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        wakeConsumer();
+    }
+};
@@ -2,10 +2,112 @@
 
 #include "../include/ConnectionHandler.h"
 #include "../include/event.h"
+#include "../include/ConsoleOutput.h"
+#include "../include/ReceiptTable.h"
+#include "../include/LatencyHistogram.h"
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <deque>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <array>
+#include <thread>
+#include <fstream>
+
+// Reports of one user for one game, plus the game state they add up to.
+// Stats are folded in as each report arrives, so summary only has to dump them.
+struct UserReports
+{
+    std::string teamA;
+    std::string teamB;
+    UpdateList generalStats;
+    UpdateList teamAStats;
+    UpdateList teamBStats;
+    std::deque<Event> events;  // ordered by event time
+    size_t spilledBytes;       // bytes handed to the spill log so far, see RetentionPolicy::spillDir
+    size_t added;              // events ever added, including evicted ones
+    size_t reorderedAt;        // value of added when a late event was last slotted in before others
+
+    UserReports() : teamA(), teamB(), generalStats(), teamAStats(), teamBStats(), events(), spilledBytes(0),
+                    added(0), reorderedAt(0) {}
+    void add(Event event);
+};
+
+// What a summary needs from one UserReports, copied out under the game lock
+// so the summary writer thread never touches the live store.
+struct SummarySnapshot
+{
+    std::string teamA;
+    std::string teamB;
+    UpdateList generalStats;
+    UpdateList teamAStats;
+    UpdateList teamBStats;
+    std::vector<Event> events;  // events still in memory, the spilled ones come before them
+    size_t added;
+    size_t reorderedAt;
+    size_t spilledBytes;
+    bool partial;               // events only holds the last ones, enough to append to a written file
+
+    SummarySnapshot() : teamA(), teamB(), generalStats(), teamAStats(), teamBStats(), events(), added(0),
+                        reorderedAt(0), spilledBytes(0), partial(false) {}
+};
+
+// One summary command, waiting for the summary writer thread.
+struct SummaryJob
+{
+    std::string gameName;
+    std::string user;
+    std::string fileName;
+    SummarySnapshot snapshot;
+};
+
+// An evicted event on its way to the spill log. Disk writes are left to the summary
+// writer thread, so the thread processing frames never waits for them.
+struct SpillRecord
+{
+    std::string path;
+    std::string header;        // "time lenA lenB lenName lenDescription\n", the raw fields follow it
+    Event event;
+};
+
+// What was last written to a summary file, so the next summary into it only appends new events.
+struct SummaryFileState
+{
+    std::string gameName;
+    std::string user;
+    size_t eventsWritten;      // UserReports::added at the time of the write
+    size_t headerBytes;        // size of the header (team names and stats) at the start of the file
+    uintmax_t fileSize;        // size we left the file at; anything else means someone else touched it
+
+    SummaryFileState() : gameName(), user(), eventsWritten(0), headerBytes(0), fileSize(0) {}
+};
+
+// Updates received for one game, grouped by reporting user.
+// Each game has its own lock so games never contend with each other.
+struct GameUpdates
+{
+    std::mutex mutex;
+    std::map<std::string, UserReports, std::less<>> byUser;
+    size_t lastUpdate;         // Frame count when an update last arrived; only used by the processing thread
+
+    GameUpdates() : mutex(), byUser(), lastUpdate(0) {}
+};
+
+// Limits on how many received updates are kept in memory. Zero means unlimited.
+struct RetentionPolicy
+{
+    size_t maxEventsPerUser;   // per (game, user)
+    size_t maxTotalBytes;      // across all games, approximate; the least recently updated games give way first
+    int maxAgeSeconds;         // by event time, relative to the newest event of that (game, user)
+    std::string spillDir;      // evicted events are appended here so summary still sees them; empty drops them.
+                               // The logs only serve the session's summaries and are removed when it ends.
+
+    RetentionPolicy() : maxEventsPerUser(0), maxTotalBytes(0), maxAgeSeconds(0), spillDir() {}
+};
 
 // TODO: implement the STOMP protocol
 class StompProtocol
@@ -13,24 +115,145 @@ class StompProtocol
     
 private:
 
-    int subId;
-    int receiptId;
-    bool shouldTerminate;
-    std::map<std::string, int> gamesToSubs;
-    std::map<int, std::string> pendingReceipts;
-    bool isConnected;
-    std::mutex mapMutex;
+    // Ids are only ever incremented, so relaxed ordering is enough for them. The flags are
+    // written by the processing thread and read by the stdin thread: release/acquire.
+    std::atomic<int> subId;
+    std::atomic<int> receiptId;
+    std::atomic<bool> shouldTerminate;
+    std::atomic<bool> isConnected;
+    std::atomic<bool> reconnecting;        // Between a lost connection and the CONNECTED that resumes it
+    std::atomic<bool> disconnecting;       // DISCONNECT sent, so the server closing is expected
     std::string username;
-    std::map<std::string, std::map<std::string, std::vector<Event>>> gameUpdates;
+    std::string passcode;                  // Kept to log in again after a lost connection
+
+    // State is split into independently locked shards so that e.g. a summary
+    // never holds a lock the network thread needs.
+    std::mutex subsMutex;                  // Guards gamesToSubs
+    std::map<std::string, int> gamesToSubs;
+    ReceiptTable pendingReceipts;          // Lock-free, shared by the stdin and processing threads
+    std::atomic<int> staleReceipts;        // Receipt ids below this were sent on a connection that was lost
+    std::atomic<int> receiptWaiters;       // Threads blocked on receiptCond
+    std::mutex receiptMutex;               // Only used to block on receiptCond
+    std::condition_variable receiptCond;   // Signalled when a receipt is resolved while someone waits
+    // Receipt round-trip times in microseconds, by ReceiptKind
+    std::array<LatencyHistogram, static_cast<size_t>(ReceiptKind::Count)> receiptLatency;
+    std::mutex gamesMutex;                 // Guards the gameUpdates index only, not its contents
+    std::map<std::string, std::shared_ptr<GameUpdates>, std::less<>> gameUpdates;
+    RetentionPolicy retention;
+    std::atomic<size_t> storedBytes;       // Approximate size of every Event held in gameUpdates
+    std::atomic<size_t> framesProcessed;   // Frames handled by processServerResponse
+    std::atomic<size_t> frameAllocations;  // Heap allocations made while handling them
+    std::map<std::string, SummaryFileState> summaryFiles;  // By file name; only used by summaryWriter
+    std::map<std::string, SummaryFileState> summaryWritten;  // Copy of summaryFiles for the summary command
+    std::mutex summaryMutex;               // Guards summaryWritten, summaryJobs and summaryStop
+    std::condition_variable summaryCond;   // Signalled when a job is queued or on shutdown
+    std::deque<SummaryJob> summaryJobs;
+    std::deque<SpillRecord> spillQueue;    // Also guarded by summaryMutex, written out before the next job
+    bool summaryStop;
+    std::thread summaryWriter;             // Started by the first summary command or spilled event
+    std::map<std::string, std::ofstream> spillLogs;  // By path, kept open; only used by summaryWriter
+    ConsoleOutput console;                 // Output of server frames and summaries, see setOutputMode
+    std::string contentEncoding;           // Encoding for sent report bodies, empty to send them as is
+    std::string decodedBody;               // Reused for encoded MESSAGE bodies by processServerResponse
+    bool requestLengthFraming;             // Ask for length-prefixed framing in CONNECT
+    int heartbeatSendMs;                   // heart-beat header of CONNECT, 0 for none
+    int heartbeatReceiveMs;
 
     std::vector<std::string> split(const std::string& s, char delimiter);
+    // Hands out a receipt id and records its action, or returns -1 if the table is full.
+    int addReceipt(ReceiptKind kind, std::string action);
+    void wakeReceiptWaiters();
+    // Store of one game, created on demand when create is true, otherwise nullptr if unknown.
+    std::shared_ptr<GameUpdates> getGame(std::string_view gameName, bool create);
+    // Drops the oldest event of one (game, user), spilling it if configured. Called with the game's lock held.
+    void evictFront(UserReports& reports, std::string_view gameName, std::string_view user);
+    // Evict from one (game, user) until its count and age limits hold. Called with game.mutex held.
+    void applyRetention(GameUpdates& game, std::string_view gameName, std::string_view user);
+    // Evict across all games until the byte limit holds. Called with no game lock held.
+    void applyByteLimit(const GameUpdates* updated, std::string_view user);
+    std::string spillPath(std::string_view gameName, std::string_view user) const;
+    // Queues an evicted event for the spill log. Called with the game's lock held.
+    void spillEvent(UserReports& reports, std::string_view gameName, std::string_view user, Event event);
+    // Runs on the summary writer thread.
+    void writeSpilled(std::deque<SpillRecord>& records);
+    // Read back the first byteLimit bytes of a spill log. Runs on the summary writer thread.
+    std::vector<Event> readSpilled(std::string_view gameName, std::string_view user, size_t byteLimit);
+    // Copy what a summary needs. Returns false if nothing was reported.
+    // Given the events already written to the file (SummaryFileState::eventsWritten), only
+    // the events after them are copied when that is enough to append.
+    bool takeSummarySnapshot(const std::string& gameName, const std::string& user, SummarySnapshot& snapshot,
+                             size_t written = 0);
+    // Events written by the last summary of this game and user into fileName, or 0.
+    size_t summaryEventsWritten(const std::string& fileName, const std::string& gameName, const std::string& user);
+    void recordSummaryWritten(const std::string& fileName, const SummaryFileState* state);
+    void queueSummary(SummaryJob job);
+    void runSummaryWriter();
+    std::string summaryHeader(const SummarySnapshot& snapshot) const;
+    void appendSummaryEvents(std::string& out, std::vector<Event>::const_iterator first,
+                             std::vector<Event>::const_iterator last) const;
+    // Runs on the summary writer thread.
+    void writeSummaryFile(SummaryJob& job);
+    bool sendReportWindow(ConnectionHandler& handler, const std::string& gameName,
+                          const std::vector<Event>& window, std::vector<int>& windowReceipts,
+                          const std::string& completion);
 
 public:
+    // Report frames sent per gather write; the last one carries a receipt.
+    static constexpr size_t REPORT_WINDOW = 16;
+    // Unacknowledged report windows allowed before report waits for a receipt.
+    static constexpr size_t REPORT_WINDOWS_IN_FLIGHT = 4;
+    static constexpr int REPORT_RECEIPT_TIMEOUT_SEC = 10;
+    // A connection is given up as dead after this many expected heart-beat intervals of silence.
+    static constexpr int HEARTBEAT_TOLERANCE = 2;
+
     StompProtocol();
+    // Finishes the queued summaries before returning.
+    ~StompProtocol();
     
+    void setRetentionPolicy(const RetentionPolicy& policy);
+    // How received updates are shown. Call before logging in.
+    void setOutputMode(ConsoleOutput::Mode mode, std::chrono::milliseconds flushInterval);
+    // Compress sent report bodies with this content-encoding; only REPORT_ENCODING is known.
+    // Returns false for an unknown encoding. Received bodies are decoded either way.
+    bool setContentEncoding(const std::string& encoding);
+    // Ask the server for length-prefixed framing when logging in.
+    void setLengthFraming(bool enabled);
+    // True if frame is a CONNECTED frame agreeing to length-prefixed framing; every
+    // frame after it, in both directions, is length-prefixed.
+    static bool agreesToLengthFraming(std::string_view frame);
+    // Heart-beats offered in CONNECT: how often we can send one, and how often we want one
+    // from the server, in milliseconds; 0 for never. Call before logging in.
+    void setHeartbeat(int sendMs, int receiveMs);
+    // Settles heart-beating from the heart-beat header of a CONNECTED frame, as in STOMP 1.2:
+    // sendInterval is how often to send one, readTimeout how long the server may stay silent.
+    // Both are zero when disabled. Returns false if neither side is enabled.
+    bool negotiateHeartbeat(std::string_view frame, std::chrono::milliseconds& sendInterval,
+                            std::chrono::milliseconds& readTimeout) const;
     bool shouldLogout();
     bool isUserConnected();
     void setConnected(bool status);
+    // CONNECT frame for the user of the last login command.
+    std::string connectFrame() const;
+    // False once the session is over or logging out, so a closed connection is not lost.
+    bool canResume();
+    // The connection was lost and is about to be resumed: commands are refused until the next
+    // CONNECTED. That frame is handled after everything read from the lost connection, so the
+    // receipts still pending then are the ones that will never come, and only those are forgotten.
+    void connectionLost();
+    // The connection was lost for good: the session ends as after logout.
+    void connectionClosed();
+    // SUBSCRIBE frames for every joined channel, under their original ids, for a resumed
+    // session. Each asks for a receipt, whose id is added to receipts.
+    std::vector<std::string> resubscribeFrames(std::vector<int>& receipts);
     void processInput(std::string line, ConnectionHandler& handler);
-    bool processServerResponse(std::string frame);
+    // Builds the SEND frame the report command uses for a single event.
+    // A receipt header is added when receipt is not negative, and a content-encoding
+    // header when the body was compressed.
+    std::string buildReportFrame(const std::string& destination, const Event& event, int receipt = -1);
+    bool processServerResponse(const std::string& frame);
+    // Where everything shown to the user during the session goes, so that replies
+    // stay in order with the updates before them.
+    ConsoleOutput& output();
+    // Average number of heap allocations per received frame so far; 0 unless built with COUNT_ALLOCS.
+    double allocationsPerFrame() const;
 };
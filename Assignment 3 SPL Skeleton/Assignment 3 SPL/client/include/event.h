@@ -4,39 +4,115 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+// flat list of update entries sorted by key.
+// iterating yields (key, value) pairs, like the std::map it replaces.
+class UpdateList
+{
+private:
+    typedef std::pair<std::string, std::string> Entry;
+    std::vector<Entry> entries;
+
+public:
+    class const_iterator
+    {
+    private:
+        std::vector<Entry>::const_iterator it;
+
+    public:
+        explicit const_iterator(std::vector<Entry>::const_iterator it) : it(it) {}
+        std::pair<const std::string &, const std::string &> operator*() const { return {it->first, it->second}; }
+        const_iterator &operator++()
+        {
+            ++it;
+            return *this;
+        }
+        bool operator!=(const const_iterator &other) const { return it != other.it; }
+        bool operator==(const const_iterator &other) const { return it == other.it; }
+    };
+
+    UpdateList();
+    explicit UpdateList(const std::map<std::string, std::string> &updates);
+    // insert the entry, or replace the value if the key is already there
+    void set(std::string_view key, std::string_view value);
+    void reserve(size_t count);
+    // the value for key, or nullptr if there is none
+    const std::string *find(std::string_view key) const;
+    size_t size() const;
+    bool empty() const;
+    void clear();
+    const_iterator begin() const;
+    const_iterator end() const;
+};
+
+// read-only view of one update list stored in an Event.
+// iterating yields (key, value) pairs of views into the event, in the order they were stored.
+class UpdateListView
+{
+private:
+    const char *first;
+    const char *last;
+
+public:
+    class const_iterator
+    {
+    private:
+        const char *at;
+
+    public:
+        explicit const_iterator(const char *at) : at(at) {}
+        std::pair<std::string_view, std::string_view> operator*() const;
+        const_iterator &operator++();
+        bool operator!=(const const_iterator &other) const { return at != other.at; }
+        bool operator==(const const_iterator &other) const { return at == other.at; }
+    };
+
+    UpdateListView(const char *first, const char *last);
+    bool empty() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+};
+
+struct ReportBodyView;
 
 class Event
 {
 private:
-    // name of team a
-    std::string team_a_name;
-    // name of team b
-    std::string team_b_name;
-    // name of the event
-    std::string name;
     // time of the event in seconds
     int time;
-    // map of all the general game updates
-    std::map<std::string, std::string> game_updates;
-    // map of all team a updates the second type can be a string bool or int
-    std::map<std::string, std::string> team_a_updates;
-    // map of all team b updates
-    std::map<std::string, std::string> team_b_updates;
-    // description of the event
-    std::string description;
+    // team names, event name, description and the three update lists in one block,
+    // so a stored event costs a single allocation (layout in event.cpp)
+    std::unique_ptr<char[]> data;
+
+    // the bytes of one field of the block
+    std::string_view field(int index) const;
 
 public:
     Event(std::string name, std::string team_a_name, std::string team_b_name, int time, std::map<std::string, std::string> game_updates, std::map<std::string, std::string> team_a_updates, std::map<std::string, std::string> team_b_updates, std::string discription);
+    Event(std::string_view team_a_name, std::string_view team_b_name, std::string_view name, int time, const UpdateList &game_updates, const UpdateList &team_a_updates, const UpdateList &team_b_updates, std::string_view discription);
+    Event(std::string_view team_a_name, std::string_view team_b_name, std::string_view name, int time, const UpdateListView &game_updates, const UpdateListView &team_a_updates, const UpdateListView &team_b_updates, std::string_view discription);
+    // decodes the body of a report MESSAGE, as built by the report command
     Event(const std::string & frame_body);
+    explicit Event(const ReportBodyView &body);
+    Event(const Event &other);
+    Event(Event &&other) = default;
+    Event &operator=(const Event &other);
+    Event &operator=(Event &&other) = default;
     virtual ~Event();
-    const std::string &get_team_a_name() const;
-    const std::string &get_team_b_name() const;
-    const std::string &get_name() const;
+    std::string_view get_team_a_name() const;
+    std::string_view get_team_b_name() const;
+    std::string_view get_name() const;
     int get_time() const;
-    const std::map<std::string, std::string> &get_game_updates() const;
-    const std::map<std::string, std::string> &get_team_a_updates() const;
-    const std::map<std::string, std::string> &get_team_b_updates() const;
-    const std::string &get_discription() const;
+    UpdateListView get_game_updates() const;
+    UpdateListView get_team_a_updates() const;
+    UpdateListView get_team_b_updates() const;
+    std::string_view get_discription() const;
+    // bytes held on the heap by this event
+    size_t heap_bytes() const;
 };
 
 // an object that holds the names of the teams and a vector of events, to be returned by the parseEventsFile function
@@ -48,3 +124,8 @@ struct names_and_events {
 
 // function that parses the json file and returns a names_and_events object
 names_and_events parseEventsFile(std::string json_path);
+
+// function that parses the json file event by event without building the whole document in memory.
+// on_event is called as soon as each event is complete; returning false from it stops the parse.
+// Returns the team names with an empty events vector. Throws if the file cannot be read or parsed.
+names_and_events streamEventsFile(std::string json_path, const std::function<bool(const Event &)> &on_event);
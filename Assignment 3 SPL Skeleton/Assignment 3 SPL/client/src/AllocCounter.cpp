@@ -0,0 +1,36 @@
+#include "../include/AllocCounter.h"
+#include <cstdlib>
+#include <new>
+
+// Per-thread so a thread can measure its own allocations without the others' noise.
+static thread_local size_t allocations = 0;
+
+size_t threadAllocations() {
+    return allocations;
+}
+
+#ifdef COUNT_ALLOCS
+void *operator new(std::size_t size) {
+    allocations++;
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    allocations++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+#endif
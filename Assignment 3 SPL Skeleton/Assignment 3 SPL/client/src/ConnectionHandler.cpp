@@ -1,4 +1,7 @@
 #include "../include/ConnectionHandler.h"
+#include <cstring>
+#include <algorithm>
+#include <array>
 
 using boost::asio::ip::tcp;
 
@@ -8,8 +11,15 @@ using std::cerr;
 using std::endl;
 using std::string;
 
-ConnectionHandler::ConnectionHandler(string host, short port) : host_(host), port_(port), io_service_(),
-                                                                socket_(io_service_) {}
+ConnectionHandler::ConnectionHandler(string host, short port) : ConnectionHandler(host, port, ownIoService_) {}
+
+ConnectionHandler::ConnectionHandler(string host, short port, boost::asio::io_service &io_service) :
+		host_(host), port_(port), ownIoService_(), io_service_(io_service), socket_(io_service_),
+		inBuf_(RECV_BUFFER_SIZE), inStart_(0), inEnd_(0), readCalls_(0), framing_(Framing::Delimited),
+		connectTimeout_(0), recvTimeout_(0), sendTimeout_(0),
+		strand_(io_service_), asyncIn_(), asyncFrame_(), outQueue_(), asyncMode_(false), asyncClosed_(false),
+		asyncDelimiter_('\0'), onFrame_(), onClose_(), heartbeatTimer_(io_service_), sendInterval_(0), readTimeout_(0),
+		lastSend_(), lastReceive_() {}
 
 ConnectionHandler::~ConnectionHandler() {
 	close();
@@ -21,7 +31,17 @@ bool ConnectionHandler::connect() {
 	try {
 		tcp::endpoint endpoint(boost::asio::ip::address::from_string(host_), port_); // the server endpoint
 		boost::system::error_code error;
-		socket_.connect(endpoint, error);
+		if (connectTimeout_.count() > 0) {
+			bool done = false;
+			socket_.async_connect(endpoint, [&error, &done](const boost::system::error_code &result) {
+				error = result;
+				done = true;
+			});
+			if (!awaitOperation(done, connectTimeout_))
+				error = boost::asio::error::timed_out;
+		} else {
+			socket_.connect(endpoint, error);
+		}
 		if (error)
 			throw boost::system::system_error(error);
 	}
@@ -32,12 +52,90 @@ bool ConnectionHandler::connect() {
 	return true;
 }
 
+void ConnectionHandler::setTimeouts(std::chrono::milliseconds connect, std::chrono::milliseconds read,
+                                    std::chrono::milliseconds write) {
+	connectTimeout_ = connect;
+	recvTimeout_ = read;
+	sendTimeout_ = write;
+}
+
+bool ConnectionHandler::awaitOperation(const bool &done, std::chrono::milliseconds timeout) {
+	// One handler at a time, so the call returns as soon as its own operation completes
+	// rather than running whatever else is queued until the deadline.
+	Clock::time_point deadline = Clock::now() + timeout;
+	io_service_.restart();
+	while (!done && io_service_.run_one_until(deadline) > 0) {}
+	bool completed = done;
+	if (!completed) {
+		// Closing the socket completes the operation with operation_aborted; run its handler
+		// so nothing still refers to the caller's locals.
+		boost::system::error_code ignored;
+		socket_.close(ignored);
+		io_service_.restart();
+		while (!done && io_service_.run_one() > 0) {}
+	}
+	// Running out of work stopped the io_service; leave it ready for run().
+	io_service_.restart();
+	return completed;
+}
+
+size_t ConnectionHandler::readSome(const boost::asio::mutable_buffer &buffer, boost::system::error_code &error) {
+	if (recvTimeout_.count() == 0) return socket_.read_some(buffer, error);
+	size_t length = 0;
+	bool done = false;
+	socket_.async_read_some(buffer, [&error, &length, &done](const boost::system::error_code &result, size_t n) {
+		error = result;
+		length = n;
+		done = true;
+	});
+	if (!awaitOperation(done, recvTimeout_))
+		error = boost::asio::error::timed_out;
+	return length;
+}
+
+size_t ConnectionHandler::writeAll(const std::vector<boost::asio::const_buffer> &buffers, boost::system::error_code &error) {
+	// asio::write keeps calling write_some until the whole sequence is sent,
+	// which for a normal-sized frame is a single writev/sendmsg.
+	if (sendTimeout_.count() == 0) return boost::asio::write(socket_, buffers, error);
+	size_t length = 0;
+	bool done = false;
+	boost::asio::async_write(socket_, buffers, [&error, &length, &done](const boost::system::error_code &result, size_t n) {
+		error = result;
+		length = n;
+		done = true;
+	});
+	if (!awaitOperation(done, sendTimeout_))
+		error = boost::asio::error::timed_out;
+	return length;
+}
+
+bool ConnectionHandler::reconnect() {
+	boost::system::error_code ignored;
+	socket_.close(ignored);
+	inStart_ = inEnd_ = 0;
+	asyncIn_.consume(asyncIn_.size());
+	outQueue_.clear();
+	framing_ = Framing::Delimited;
+	sendInterval_ = readTimeout_ = std::chrono::milliseconds(0);
+	// asyncClosed_ stays set, so frames from other threads are refused until startAsync.
+	asyncMode_ = false;
+	io_service_.restart();
+	return connect();
+}
+
 bool ConnectionHandler::getBytes(char bytes[], unsigned int bytesToRead) {
 	size_t tmp = 0;
+	// Serve whatever is already buffered before touching the socket.
+	if (inStart_ < inEnd_) {
+		tmp = std::min(inEnd_ - inStart_, (size_t) bytesToRead);
+		std::memcpy(bytes, inBuf_.data() + inStart_, tmp);
+		inStart_ += tmp;
+	}
 	boost::system::error_code error;
 	try {
 		while (!error && bytesToRead > tmp) {
-			tmp += socket_.read_some(boost::asio::buffer(bytes + tmp, bytesToRead - tmp), error);
+			readCalls_++;
+			tmp += readSome(boost::asio::buffer(bytes + tmp, bytesToRead - tmp), error);
 		}
 		if (error)
 			throw boost::system::system_error(error);
@@ -48,12 +146,37 @@ bool ConnectionHandler::getBytes(char bytes[], unsigned int bytesToRead) {
 	return true;
 }
 
+bool ConnectionHandler::fillBuffer() {
+	// Slide the unconsumed tail to the front so the free space is contiguous.
+	if (inStart_ > 0) {
+		if (inStart_ < inEnd_)
+			std::memmove(inBuf_.data(), inBuf_.data() + inStart_, inEnd_ - inStart_);
+		inEnd_ -= inStart_;
+		inStart_ = 0;
+	}
+	if (inEnd_ == inBuf_.size())
+		inBuf_.resize(inBuf_.size() * 2);
+
+	boost::system::error_code error;
+	try {
+		readCalls_++;
+		size_t n = readSome(boost::asio::buffer(inBuf_.data() + inEnd_, inBuf_.size() - inEnd_), error);
+		if (error)
+			throw boost::system::system_error(error);
+		inEnd_ += n;
+	} catch (std::exception &e) {
+		std::cerr << "recv failed (Error: " << e.what() << ')' << std::endl;
+		return false;
+	}
+	return true;
+}
+
 bool ConnectionHandler::sendBytes(const char bytes[], int bytesToWrite) {
 	int tmp = 0;
 	boost::system::error_code error;
 	try {
 		while (!error && bytesToWrite > tmp) {
-			tmp += socket_.write_some(boost::asio::buffer(bytes + tmp, bytesToWrite - tmp), error);
+			tmp += writeAll({boost::asio::buffer(bytes + tmp, bytesToWrite - tmp)}, error);
 		}
 		if (error)
 			throw boost::system::system_error(error);
@@ -74,28 +197,296 @@ bool ConnectionHandler::sendLine(std::string &line) {
 
 
 bool ConnectionHandler::getFrameAscii(std::string &frame, char delimiter) {
-	char ch;
-	// Stop when we encounter the null character.
+	if (framing_ == Framing::LengthPrefixed) {
+		return getFramePrefixed(frame);
+	}
+	// Stop when we encounter the delimiter character.
 	// Notice that the null character is not appended to the frame string.
+	size_t scanned = inStart_;
 	try {
-		do {
-			if (!getBytes(&ch, 1)) {
-				return false;
+		while (true) {
+			const char *begin = inBuf_.data() + scanned;
+			const char *hit = static_cast<const char *>(std::memchr(begin, delimiter, inEnd_ - scanned));
+			if (hit == nullptr) {
+				scanned = inEnd_ - inStart_;
+				if (!fillBuffer()) {
+					return false;
+				}
+				scanned += inStart_;
+				continue;
 			}
-			if (ch != '\0')
-				frame.append(1, ch);
-		} while (delimiter != ch);
+			const char *first = inBuf_.data() + inStart_;
+			const char *last = hit + (delimiter == '\0' ? 0 : 1);
+			// Drop any stray null characters that precede a non-null delimiter.
+			while (first < last) {
+				const char *nul = static_cast<const char *>(std::memchr(first, '\0', last - first));
+				const char *stop = nul == nullptr ? last : nul;
+				frame.append(first, stop - first);
+				first = nul == nullptr ? last : nul + 1;
+			}
+			inStart_ = hit - inBuf_.data() + 1;
+			return true;
+		}
 	} catch (std::exception &e) {
 		std::cerr << "recv failed2 (Error: " << e.what() << ')' << std::endl;
 		return false;
 	}
-	return true;
+}
+
+bool ConnectionHandler::getFramePrefixed(std::string &frame) {
+	char prefix[4];
+	if (!getBytes(prefix, sizeof(prefix)))
+		return false;
+	uint32_t length = getLength(prefix);
+	if (length > MAX_FRAME_LENGTH) {
+		std::cerr << "recv failed (Error: frame of " << length << " bytes is too large)" << std::endl;
+		return false;
+	}
+	size_t start = frame.size();
+	frame.resize(start + length);
+	return length == 0 || getBytes(&frame[start], length);
+}
+
+uint32_t ConnectionHandler::getLength(const char prefix[4]) {
+	const unsigned char *p = reinterpret_cast<const unsigned char *>(prefix);
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+void ConnectionHandler::putLength(char prefix[4], size_t length) {
+	prefix[0] = static_cast<char>(length >> 24);
+	prefix[1] = static_cast<char>(length >> 16);
+	prefix[2] = static_cast<char>(length >> 8);
+	prefix[3] = static_cast<char>(length);
 }
 
 bool ConnectionHandler::sendFrameAscii(const std::string &frame, char delimiter) {
-	bool result = sendBytes(frame.c_str(), frame.length());
-	if (!result) return false;
-	return sendBytes(&delimiter, 1);
+	bool prefixed = framing_ == Framing::LengthPrefixed;
+	char prefix[4];
+	if (prefixed) putLength(prefix, frame.size());
+	if (asyncClosed_) return false;
+	if (asyncMode_) {
+		enqueueAsync(prefixed ? std::string(prefix, sizeof(prefix)) + frame : frame + delimiter);
+		return true;
+	}
+	// Body and delimiter (or length prefix and body) go out together in one gather write.
+	std::vector<boost::asio::const_buffer> buffers;
+	if (prefixed) buffers.push_back(boost::asio::buffer(prefix, sizeof(prefix)));
+	buffers.push_back(boost::asio::buffer(frame));
+	if (!prefixed) buffers.push_back(boost::asio::buffer(&delimiter, 1));
+	return sendBuffers(buffers);
+}
+
+bool ConnectionHandler::sendFrameAscii(const std::vector<std::string> &frames, char delimiter) {
+	if (asyncClosed_) return false;
+	if (!asyncMode_) return sendFramesBlocking(frames, delimiter);
+	bool prefixed = framing_ == Framing::LengthPrefixed;
+	std::vector<std::array<char, 4>> prefixes(prefixed ? frames.size() : 0);
+	for (size_t i = 0; i < prefixes.size(); i++) putLength(prefixes[i].data(), frames[i].size());
+	std::string data;
+	for (size_t i = 0; i < frames.size(); i++) {
+		if (prefixed) data.append(prefixes[i].data(), prefixes[i].size());
+		data += frames[i];
+		if (!prefixed) data += delimiter;
+	}
+	enqueueAsync(std::move(data));
+	return true;
+}
+
+bool ConnectionHandler::sendWhileResuming(const std::vector<std::string> &frames, char delimiter) {
+	return sendFramesBlocking(frames, delimiter);
+}
+
+bool ConnectionHandler::sendFramesBlocking(const std::vector<std::string> &frames, char delimiter) {
+	bool prefixed = framing_ == Framing::LengthPrefixed;
+	std::vector<std::array<char, 4>> prefixes(prefixed ? frames.size() : 0);
+	for (size_t i = 0; i < prefixes.size(); i++) putLength(prefixes[i].data(), frames[i].size());
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.reserve(frames.size() * 2);
+	for (size_t i = 0; i < frames.size(); i++) {
+		if (prefixed) buffers.push_back(boost::asio::buffer(prefixes[i]));
+		buffers.push_back(boost::asio::buffer(frames[i]));
+		if (!prefixed) buffers.push_back(boost::asio::buffer(&delimiter, 1));
+	}
+	return sendBuffers(buffers);
+}
+
+bool ConnectionHandler::sendBuffers(const std::vector<boost::asio::const_buffer> &buffers) {
+	boost::system::error_code error;
+	try {
+		writeAll(buffers, error);
+		if (error)
+			throw boost::system::system_error(error);
+	} catch (std::exception &e) {
+		std::cerr << "send failed (Error: " << e.what() << ')' << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void ConnectionHandler::startAsync(char delimiter, FrameHandler onFrame, CloseHandler onClose) {
+	asyncDelimiter_ = delimiter;
+	onFrame_ = onFrame;
+	onClose_ = onClose;
+	// Bytes already pulled in by the blocking reader belong to the async stream.
+	if (inStart_ < inEnd_) {
+		size_t n = inEnd_ - inStart_;
+		boost::asio::buffer_copy(asyncIn_.prepare(n), boost::asio::buffer(inBuf_.data() + inStart_, n));
+		asyncIn_.commit(n);
+		inStart_ = inEnd_ = 0;
+	}
+	asyncMode_ = true;
+	asyncClosed_ = false;
+	boost::asio::post(strand_, [this]() { asyncReadFrame(); });
+}
+
+void ConnectionHandler::run() {
+	io_service_.run();
+}
+
+void ConnectionHandler::stopAsync() {
+	boost::asio::post(strand_, [this]() { finishAsync(false); });
+}
+
+void ConnectionHandler::setFraming(Framing framing) {
+	framing_ = framing;
+}
+
+ConnectionHandler::Framing ConnectionHandler::getFraming() const {
+	return framing_;
+}
+
+void ConnectionHandler::setHeartbeat(std::chrono::milliseconds sendInterval, std::chrono::milliseconds readTimeout) {
+	boost::asio::post(strand_, [this, sendInterval, readTimeout]() {
+		sendInterval_ = sendInterval;
+		readTimeout_ = readTimeout;
+		lastSend_ = lastReceive_ = Clock::now();
+		heartbeatTimer_.cancel();
+		scheduleHeartbeat();
+	});
+}
+
+// Hands every complete frame already in asyncIn_ to onFrame, then reads whatever arrives next.
+// Reading with plain read_some, rather than until a delimiter or a length, means every byte
+// that arrives counts as a sign of life for the read deadline, heart-beats included.
+void ConnectionHandler::asyncReadFrame() {
+	while (true) {
+		const char *data = static_cast<const char *>(asyncIn_.data().data());
+		size_t size = asyncIn_.size();
+		size_t start = 0;
+		size_t length = 0;
+		size_t consumed = 0;
+		if (framing_ == Framing::LengthPrefixed) {
+			if (size < 4) break;
+			uint32_t frameLength = getLength(data);
+			if (frameLength > MAX_FRAME_LENGTH) {
+				std::cerr << "recv failed (Error: frame of " << frameLength << " bytes is too large)" << std::endl;
+				finishAsync(true);
+				return;
+			}
+			if (size < 4 + frameLength) break;
+			start = 4;
+			length = frameLength;
+			consumed = 4 + frameLength;
+		} else {
+			// Heart-beats are end of lines between frames.
+			size_t skip = 0;
+			while (asyncDelimiter_ != '\n' && skip < size && (data[skip] == '\n' || data[skip] == '\r')) skip++;
+			if (skip > 0) {
+				asyncIn_.consume(skip);
+				continue;
+			}
+			const char *hit = static_cast<const char *>(std::memchr(data, asyncDelimiter_, size));
+			if (hit == nullptr) break;
+			// Same shape as getFrameAscii: a null delimiter is not part of the frame.
+			length = hit - data + (asyncDelimiter_ == '\0' ? 0 : 1);
+			consumed = hit - data + 1;
+		}
+		asyncFrame_.assign(data + start, length);
+		asyncIn_.consume(consumed);
+		if (framing_ == Framing::Delimited && asyncDelimiter_ != '\0')
+			asyncFrame_.erase(std::remove(asyncFrame_.begin(), asyncFrame_.end(), '\0'), asyncFrame_.end());
+		// An empty frame is a heart-beat in LengthPrefixed mode.
+		if (asyncFrame_.empty()) continue;
+		if (!onFrame_(asyncFrame_)) {
+			finishAsync(false);
+			return;
+		}
+	}
+	socket_.async_read_some(asyncIn_.prepare(RECV_BUFFER_SIZE),
+		boost::asio::bind_executor(strand_, [this](const boost::system::error_code &error, size_t length) {
+			onAsyncRead(error, length);
+		}));
+}
+
+void ConnectionHandler::onAsyncRead(const boost::system::error_code &error, size_t length) {
+	if (asyncClosed_) return;
+	if (error) {
+		finishAsync(true);
+		return;
+	}
+	asyncIn_.commit(length);
+	lastReceive_ = Clock::now();
+	asyncReadFrame();
+}
+
+// Wakes at whichever comes first: the next heart-beat due or the read deadline.
+void ConnectionHandler::scheduleHeartbeat() {
+	if (asyncClosed_) return;
+	Clock::time_point wakeAt = Clock::time_point::max();
+	if (sendInterval_.count() > 0) wakeAt = std::min(wakeAt, lastSend_ + sendInterval_);
+	if (readTimeout_.count() > 0) wakeAt = std::min(wakeAt, lastReceive_ + readTimeout_);
+	if (wakeAt == Clock::time_point::max()) return;
+	heartbeatTimer_.expires_at(wakeAt);
+	heartbeatTimer_.async_wait(boost::asio::bind_executor(strand_, [this](const boost::system::error_code &error) {
+		if (error || asyncClosed_) return;
+		Clock::time_point now = Clock::now();
+		if (readTimeout_.count() > 0 && now - lastReceive_ >= readTimeout_) {
+			std::cerr << "recv failed (Error: nothing received for " << readTimeout_.count() << " ms)" << std::endl;
+			finishAsync(true);
+			return;
+		}
+		if (sendInterval_.count() > 0 && now - lastSend_ >= sendInterval_) {
+			writeAsync(framing_ == Framing::LengthPrefixed ? std::string(4, '\0') : std::string(1, '\n'));
+		}
+		scheduleHeartbeat();
+	}));
+}
+
+void ConnectionHandler::enqueueAsync(std::string data) {
+	boost::asio::post(strand_, [this, data = std::move(data)]() mutable {
+		writeAsync(std::move(data));
+	});
+}
+
+void ConnectionHandler::writeAsync(std::string data) {
+	if (asyncClosed_) return;
+	lastSend_ = Clock::now();
+	bool idle = outQueue_.empty();
+	outQueue_.push_back(std::move(data));
+	if (idle) asyncWriteNext();
+}
+
+void ConnectionHandler::asyncWriteNext() {
+	boost::asio::async_write(socket_, boost::asio::buffer(outQueue_.front()),
+		boost::asio::bind_executor(strand_, [this](const boost::system::error_code &error, size_t) {
+			if (asyncClosed_) return;
+			if (error) {
+				std::cerr << "send failed (Error: " << error.message() << ')' << std::endl;
+				finishAsync(true);
+				return;
+			}
+			outQueue_.pop_front();
+			if (!outQueue_.empty()) asyncWriteNext();
+		}));
+}
+
+void ConnectionHandler::finishAsync(bool lost) {
+	if (asyncClosed_.exchange(true)) return;
+	outQueue_.clear();
+	heartbeatTimer_.cancel();
+	boost::system::error_code ignored;
+	socket_.close(ignored);
+	if (lost && onClose_) onClose_();
 }
 
 // Close down the connection properly.
@@ -106,3 +497,7 @@ void ConnectionHandler::close() {
 		std::cout << "closing failed: connection already closed" << std::endl;
 	}
 }
+
+size_t ConnectionHandler::getReadCalls() const {
+	return readCalls_;
+}
@@ -0,0 +1,105 @@
+#include "../include/ConsoleOutput.h"
+
+ConsoleOutput::ConsoleOutput(std::ostream& out) :
+    out_(out), mode_(Mode::Immediate), flushInterval_(100), mutex_(), wakeup_(), drained_(), pending_(), dropped_(0),
+    flushNow_(false), stop_(false), writer_() {}
+
+ConsoleOutput::~ConsoleOutput() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wakeup_.notify_one();
+    drained_.notify_all();
+    if (writer_.joinable()) writer_.join();
+}
+
+void ConsoleOutput::setMode(Mode mode, std::chrono::milliseconds flushInterval) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    mode_ = mode;
+    flushInterval_ = flushInterval;
+    if ((mode == Mode::Buffered || mode == Mode::Compact) && !writer_.joinable()) {
+        writer_ = std::thread(&ConsoleOutput::runWriter, this);
+    }
+}
+
+ConsoleOutput::Mode ConsoleOutput::mode() const {
+    return mode_;
+}
+
+void ConsoleOutput::update(std::initializer_list<std::string_view> pieces) {
+    if (mode_ == Mode::Quiet) return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!writer_.joinable()) {
+        for (std::string_view piece : pieces) out_.write(piece.data(), piece.size());
+        out_.flush();
+        return;
+    }
+    // The terminal is slower than the updates coming in: don't let them pile up without bound.
+    if (pending_.size() >= MAX_PENDING_BYTES) {
+        if (mode_ == Mode::Compact) {
+            dropped_++;
+            return;
+        }
+        flushNow_ = true;
+        wakeup_.notify_one();
+        drained_.wait(lock, [this] { return pending_.size() < MAX_PENDING_BYTES || stop_; });
+    }
+    for (std::string_view piece : pieces) pending_.append(piece.data(), piece.size());
+    if (pending_.size() >= FLUSH_BYTES) {
+        flushNow_ = true;
+        wakeup_.notify_one();
+    }
+}
+
+void ConsoleOutput::line(std::string_view text) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!writer_.joinable()) {
+        out_.write(text.data(), text.size());
+        out_ << std::endl;
+        return;
+    }
+    noteDropped();
+    pending_.append(text.data(), text.size());
+    pending_ += '\n';
+    flushNow_ = true;
+    wakeup_.notify_one();
+}
+
+void ConsoleOutput::noteDropped() {
+    if (dropped_ == 0) return;
+    pending_ += "(" + std::to_string(dropped_) + " updates not shown, the terminal fell behind)\n";
+    dropped_ = 0;
+}
+
+// Swaps the pending output out and writes it with the lock released,
+// so the threads producing output never wait for the terminal.
+void ConsoleOutput::runWriter() {
+    std::string writing;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wakeup_.wait_for(lock, flushInterval_, [this] { return flushNow_ || stop_; });
+        flushNow_ = false;
+        bool last = stop_;
+        noteDropped();
+        pending_.swap(writing);
+        lock.unlock();
+        drained_.notify_all();
+        if (!writing.empty()) {
+            out_.write(writing.data(), writing.size());
+            out_.flush();
+            writing.clear();
+        }
+        if (last) return;
+        lock.lock();
+    }
+}
+
+bool ConsoleOutput::parseMode(const std::string& name, Mode& mode) {
+    if (name == "immediate") mode = Mode::Immediate;
+    else if (name == "buffered") mode = Mode::Buffered;
+    else if (name == "compact") mode = Mode::Compact;
+    else if (name == "quiet") mode = Mode::Quiet;
+    else return false;
+    return true;
+}
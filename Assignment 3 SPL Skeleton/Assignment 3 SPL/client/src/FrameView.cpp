@@ -0,0 +1,106 @@
+#include "../include/FrameView.h"
+#include <charconv>
+
+std::string_view trimCR(std::string_view line) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    return line;
+}
+
+// Cut the next line out of text starting at pos, and move pos past its '\n'.
+static std::string_view nextLine(std::string_view text, size_t &pos) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string_view::npos) end = text.size();
+    std::string_view line = text.substr(pos, end - pos);
+    pos = end < text.size() ? end + 1 : end;
+    return trimCR(line);
+}
+
+static bool startsWith(std::string_view s, std::string_view prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+FrameView::FrameView(std::string_view frame) : command_(), headers_(), headerCount_(0), body_() {
+    size_t pos = 0;
+    // Tolerate the stray newline a server may leave between frames.
+    while (pos < frame.size() && (frame[pos] == '\n' || frame[pos] == '\r')) pos++;
+    command_ = nextLine(frame, pos);
+
+    while (pos < frame.size()) {
+        std::string_view line = nextLine(frame, pos);
+        if (line.empty()) {
+            body_ = frame.substr(pos);
+            return;
+        }
+        size_t colon = line.find(':');
+        if (colon != std::string_view::npos && headerCount_ < MAX_HEADERS) {
+            headers_[headerCount_++] = {line.substr(0, colon), line.substr(colon + 1)};
+        }
+    }
+}
+
+std::string_view FrameView::command() const {
+    return command_;
+}
+
+std::string_view FrameView::header(std::string_view name) const {
+    for (size_t i = 0; i < headerCount_; i++) {
+        if (headers_[i].first == name) return headers_[i].second;
+    }
+    return std::string_view();
+}
+
+bool FrameView::hasHeader(std::string_view name) const {
+    for (size_t i = 0; i < headerCount_; i++) {
+        if (headers_[i].first == name) return true;
+    }
+    return false;
+}
+
+std::string_view FrameView::body() const {
+    return body_;
+}
+
+ReportBodyView::ReportBodyView(std::string_view body) :
+    user(), team_a(), team_b(), event_name(), time(0), general_updates(), team_a_updates(),
+    team_b_updates(), description()
+{
+    std::string_view *section = nullptr;
+    size_t sectionStart = 0;
+    size_t pos = 0;
+
+    while (pos < body.size()) {
+        size_t lineStart = pos;
+        std::string_view line = nextLine(body, pos);
+
+        std::string_view *next = nullptr;
+        bool closesSection = true;
+        if (line == "general game updates:") next = &general_updates;
+        else if (line == "team a updates:") next = &team_a_updates;
+        else if (line == "team b updates:") next = &team_b_updates;
+        else if (line == "description:") next = &description;
+        else closesSection = false;
+
+        if (closesSection) {
+            if (section != nullptr) *section = body.substr(sectionStart, lineStart - sectionStart);
+            if (next == &description) {
+                description = body.substr(pos);
+                return;
+            }
+            section = next;
+            sectionStart = pos;
+            continue;
+        }
+        // Inside an update section every line is a key:value entry of that section.
+        if (section != nullptr) continue;
+
+        if (startsWith(line, "user:")) user = line.substr(5);
+        else if (startsWith(line, "team a:")) team_a = line.substr(7);
+        else if (startsWith(line, "team b:")) team_b = line.substr(7);
+        else if (startsWith(line, "event name:")) event_name = line.substr(11);
+        else if (startsWith(line, "time:")) {
+            std::string_view value = line.substr(5);
+            std::from_chars(value.data(), value.data() + value.size(), time);
+        }
+    }
+    if (section != nullptr) *section = body.substr(sectionStart);
+}
@@ -0,0 +1,52 @@
+#include "../include/LatencyHistogram.h"
+#include <algorithm>
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram() : counts_(), total_(0), max_(0) {
+    for (std::atomic<uint64_t>& count : counts_) count.store(0, std::memory_order_relaxed);
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t value) {
+    if (value < LINEAR_BUCKETS) return value;
+    unsigned msb = 63 - __builtin_clzll(value);
+    unsigned shift = msb - SUB_BUCKET_BITS;   // value >> shift is in [16, 32)
+    uint64_t sub = (value >> shift) - (1 << SUB_BUCKET_BITS);
+    return LINEAR_BUCKETS + (shift - 1) * (1 << SUB_BUCKET_BITS) + sub;
+}
+
+uint64_t LatencyHistogram::valueOf(size_t bucket) {
+    if (bucket < LINEAR_BUCKETS) return bucket;
+    size_t index = bucket - LINEAR_BUCKETS;
+    unsigned shift = index / (1 << SUB_BUCKET_BITS) + 1;
+    uint64_t sub = index % (1 << SUB_BUCKET_BITS) + (1 << SUB_BUCKET_BITS);
+    return (sub << shift) + (uint64_t(1) << shift) / 2;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    counts_[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = max_.load(std::memory_order_relaxed);
+    while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+uint64_t LatencyHistogram::count() const {
+    return total_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::max() const {
+    return max_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * total)));
+    // The top record is known exactly; a bucket midpoint could fall below it.
+    if (rank >= total) return max();
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+        seen += counts_[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) return std::min(valueOf(bucket), max());
+    }
+    return max();
+}
@@ -0,0 +1,60 @@
+#include "../include/ReceiptTable.h"
+
+ReceiptTable::ReceiptTable() : slots_(new Slot[CAPACITY]), maxProbe_(0) {}
+
+ReceiptTable::Slot& ReceiptTable::slotAt(int id, size_t probe) const {
+    return slots_[(static_cast<unsigned>(id) + probe) % CAPACITY];
+}
+
+ReceiptTable::Slot* ReceiptTable::find(int id) const {
+    size_t limit = maxProbe_.load(std::memory_order_acquire);
+    for (size_t probe = 0; probe <= limit; probe++) {
+        Slot& slot = slotAt(id, probe);
+        if (slot.key.load(std::memory_order_seq_cst) == id) return &slot;
+    }
+    return nullptr;
+}
+
+bool ReceiptTable::insert(int id, ReceiptKind kind, std::string action) {
+    for (size_t probe = 0; probe < CAPACITY; probe++) {
+        Slot& slot = slotAt(id, probe);
+        int expected = EMPTY;
+        if (!slot.key.compare_exchange_strong(expected, BUSY, std::memory_order_acquire)) continue;
+        // Raised before the key is published, so a lookup that can see the key probes far enough.
+        size_t longest = maxProbe_.load(std::memory_order_relaxed);
+        while (longest < probe && !maxProbe_.compare_exchange_weak(longest, probe, std::memory_order_release)) {}
+        slot.receipt.kind = kind;
+        slot.receipt.action = std::move(action);
+        slot.receipt.sentAt = std::chrono::steady_clock::now();
+        slot.key.store(id, std::memory_order_release);
+        return true;
+    }
+    return false;
+}
+
+bool ReceiptTable::take(int id, PendingReceipt& receipt) {
+    Slot* slot = find(id);
+    if (slot == nullptr) return false;
+    int expected = id;
+    if (!slot->key.compare_exchange_strong(expected, BUSY, std::memory_order_acquire)) return false;
+    receipt.kind = slot->receipt.kind;
+    receipt.sentAt = slot->receipt.sentAt;
+    receipt.action.swap(slot->receipt.action);
+    slot->receipt.action.clear();
+    // Sequentially consistent, so a thread that registers as a waiter and then checks
+    // contains() cannot miss this release; see StompProtocol::wakeReceiptWaiters.
+    slot->key.store(EMPTY, std::memory_order_seq_cst);
+    return true;
+}
+
+bool ReceiptTable::contains(int id) const {
+    return find(id) != nullptr;
+}
+
+void ReceiptTable::clearBefore(int before) {
+    PendingReceipt discarded;
+    for (size_t i = 0; i < CAPACITY; i++) {
+        int id = slots_[i].key.load(std::memory_order_acquire);
+        if (id >= 0 && id < before) take(id, discarded);
+    }
+}
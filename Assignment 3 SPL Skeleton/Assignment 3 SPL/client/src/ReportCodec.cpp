@@ -0,0 +1,128 @@
+#include "../include/ReportCodec.h"
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+static const char MARK = '\x01';
+static const unsigned char DIGIT_BASE = 0x21;           // '!'
+static const size_t RADIX = 94;                         // '!' .. '~'
+static const size_t MIN_MATCH = 5;                      // A back-reference costs 4 bytes
+static const size_t MAX_MATCH = MIN_MATCH + RADIX - 1;
+static const size_t MAX_OFFSET = RADIX * RADIX;
+static const unsigned HASH_BITS = 13;
+static const int MAX_CHAIN = 32;
+
+// Shared by every client; changing it changes the encoding.
+// The most common strings are at the end, where offsets to them are smallest.
+static const std::string_view DICTIONARY =
+    " the ball into the back of the net. What a goal! a free-kick from the left corner, "
+    "the penalty area and the box. the first half, the second half, half-time, "
+    "the referee, after a VAR review, offside position, yellow card, red card, "
+    "substitution, and the goalkeeper saves the shot. They have to be ahead of the game, "
+    "but it is still just one goal at the break for the lead. "
+    "possession:50%\ngoals:0\ngoals:1\ngoals:2\ngoals:3\nyellow cards:1\nred cards:0\n"
+    "active:true\nactive:false\nbefore halftime:true\nbefore halftime:false\n"
+    "event name:kickoff\nevent name:goal!!!!\nevent name:halftime\nevent name:final whistle\n"
+    "user:\nteam a:\nteam b:\nevent name:\ntime:\n"
+    "general game updates:\nteam a updates:\nteam b updates:\ndescription:\n";
+
+static bool isContinuation(unsigned char c) {
+    return (c & 0xC0) == 0x80;
+}
+
+static uint32_t hashAt(const std::string& buf, size_t pos) {
+    uint32_t v;
+    std::memcpy(&v, buf.data() + pos, sizeof(v));
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+bool compressReportBody(std::string_view body, std::string& out) {
+    if (body.find_first_of(std::string_view("\0\x01\r", 3)) != std::string_view::npos) return false;
+
+    // Dictionary and body in one buffer, so a back-reference may point into either.
+    std::string buf;
+    buf.reserve(DICTIONARY.size() + body.size());
+    buf.append(DICTIONARY);
+    buf.append(body);
+    std::vector<int32_t> head(size_t(1) << HASH_BITS, -1);
+    std::vector<int32_t> prev(buf.size(), -1);
+    auto insert = [&](size_t pos) {
+        if (pos + 4 > buf.size()) return;
+        uint32_t h = hashAt(buf, pos);
+        prev[pos] = head[h];
+        head[h] = static_cast<int32_t>(pos);
+    };
+    for (size_t pos = 0; pos < DICTIONARY.size(); pos++) insert(pos);
+
+    std::string encoded;
+    encoded.reserve(body.size());
+    size_t pos = DICTIONARY.size();
+    while (pos < buf.size()) {
+        size_t bestLength = 0;
+        size_t bestOffset = 0;
+        if (pos + MIN_MATCH <= buf.size() && !isContinuation(buf[pos])) {
+            size_t limit = std::min(MAX_MATCH, buf.size() - pos);
+            int chain = 0;
+            for (int32_t candidate = head[hashAt(buf, pos)]; candidate >= 0 && chain < MAX_CHAIN;
+                 candidate = prev[candidate], chain++) {
+                size_t offset = pos - candidate;
+                if (offset > MAX_OFFSET) break;
+                size_t length = 0;
+                while (length < limit && buf[candidate + length] == buf[pos + length]) length++;
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestOffset = offset;
+                    if (length == limit) break;
+                }
+            }
+            while (bestLength >= MIN_MATCH && pos + bestLength < buf.size() &&
+                   isContinuation(buf[pos + bestLength])) {
+                bestLength--;
+            }
+        }
+
+        if (bestLength >= MIN_MATCH) {
+            encoded += MARK;
+            encoded += static_cast<char>(DIGIT_BASE + bestLength - MIN_MATCH);
+            encoded += static_cast<char>(DIGIT_BASE + (bestOffset - 1) / RADIX);
+            encoded += static_cast<char>(DIGIT_BASE + (bestOffset - 1) % RADIX);
+            for (size_t end = pos + bestLength; pos < end; pos++) insert(pos);
+        } else {
+            encoded += buf[pos];
+            insert(pos);
+            pos++;
+        }
+    }
+
+    if (encoded.size() >= body.size()) return false;
+    out.swap(encoded);
+    return true;
+}
+
+bool decompressReportBody(std::string_view encoded, std::string& out) {
+    out.clear();
+    for (size_t i = 0; i < encoded.size(); i++) {
+        if (encoded[i] != MARK) {
+            out += encoded[i];
+            continue;
+        }
+        if (i + 3 >= encoded.size()) return false;
+        size_t digits[3];
+        for (size_t d = 0; d < 3; d++) {
+            unsigned char c = encoded[i + 1 + d];
+            if (c < DIGIT_BASE || c >= DIGIT_BASE + RADIX) return false;
+            digits[d] = c - DIGIT_BASE;
+        }
+        i += 3;
+        size_t length = digits[0] + MIN_MATCH;
+        size_t offset = digits[1] * RADIX + digits[2] + 1;
+        if (offset > DICTIONARY.size() + out.size()) return false;
+        // Byte by byte: the source may overlap what is being written.
+        size_t source = DICTIONARY.size() + out.size() - offset;
+        for (size_t n = 0; n < length; n++, source++) {
+            out += source < DICTIONARY.size() ? DICTIONARY[source] : out[source - DICTIONARY.size()];
+        }
+    }
+    return true;
+}
@@ -1,17 +1,132 @@
 #include <stdlib.h>
 #include "../include/ConnectionHandler.h"
 #include "../include/StompProtocol.h"
+#include "../include/SpscQueue.h"
+#include "../include/FrameView.h"
 #include <thread>
 #include <vector>
+#include <set>
+#include <charconv>
 
+// Received frames that may wait for processing before the reader stops reading.
+static const size_t FRAME_QUEUE_CAPACITY = 4096;
+// Backoff between reconnect attempts, doubled after every failed one.
+static const int RECONNECT_INITIAL_DELAY_MS = 500;
+static const int RECONNECT_MAX_DELAY_MS = 30000;
+
+// The answer to CONNECT decides the framing of every frame after it, and heart-beating.
+static void applyFraming(ConnectionHandler &handler, bool lengthFraming, const std::string &answer) {
+	if (lengthFraming && StompProtocol::agreesToLengthFraming(answer))
+		handler.setFraming(ConnectionHandler::Framing::LengthPrefixed);
+}
+
+// Only once in async mode: heart-beats are driven by the async reader and writer.
+static void applyHeartbeat(ConnectionHandler &handler, const StompProtocol &protocol, const std::string &answer) {
+	std::chrono::milliseconds sendInterval, readTimeout;
+	if (protocol.negotiateHeartbeat(answer, sendInterval, readTimeout))
+		handler.setHeartbeat(sendInterval, readTimeout);
+}
+
+// Blocking read of the next frame, skipping heart-beats.
+static bool readFrame(ConnectionHandler &handler, std::string &frame) {
+	do {
+		frame.clear();
+		if (!handler.getFrameAscii(frame, '\0')) return false;
+		frame.erase(0, frame.find_first_not_of("\r\n"));
+	} while (frame.empty());
+	return true;
+}
+
+// Logs in again on a lost connection and replays every subscription, reading until all of
+// their receipts are back. Frames read on the way are added to received, in order, for the
+// processing thread. Returns false if this attempt failed and another one should be made;
+// true also when the server answered with ERROR, which ends the session once processed.
+static bool resumeSession(ConnectionHandler &handler, StompProtocol &protocol, bool lengthFraming,
+                          std::vector<std::string> &received) {
+	if (!handler.reconnect() || !handler.sendWhileResuming({protocol.connectFrame()}, '\0')) return false;
+	std::string answer;
+	if (!readFrame(handler, answer)) return false;
+	received.push_back(answer);
+	if (FrameView(answer).command() != "CONNECTED") return true;
+	applyFraming(handler, lengthFraming, answer);
+
+	std::vector<int> receipts;
+	std::vector<std::string> subscribes = protocol.resubscribeFrames(receipts);
+	if (!subscribes.empty() && !handler.sendWhileResuming(subscribes, '\0')) return false;
+	std::set<int> waiting(receipts.begin(), receipts.end());
+	while (!waiting.empty()) {
+		if (!readFrame(handler, answer)) return false;
+		received.push_back(answer);
+		FrameView view(answer);
+		if (view.command() == "ERROR") return true;
+		std::string_view receiptId = view.header("receipt-id");
+		int id = 0;
+		if (view.command() == "RECEIPT" &&
+		    std::from_chars(receiptId.data(), receiptId.data() + receiptId.size(), id).ec == std::errc())
+			waiting.erase(id);
+	}
+	return true;
+}
 
 int main(int argc, char *argv[]) {
+	// Optional limits on the updates kept in memory:
+	// --max-events N --max-bytes N --max-age SECONDS --spill-dir DIR
+	// and how updates are shown: --output immediate|buffered|compact|quiet --flush-ms N
+	// Reports can be sent compressed: --content-encoding x-report-lz
+	// and frames length-prefixed instead of NUL-terminated, if the server agrees: --framing length
+	// Heart-beats offered to the server, in ms, 0 to turn either direction off: --heart-beat SEND,RECEIVE
+	// A lost connection is resumed, joined channels included, with up to N attempts: --reconnect N
+	// Deadlines in ms for connecting and for blocking reads and writes, 0 to wait forever:
+	// --connect-timeout MS --read-timeout MS --write-timeout MS
+	RetentionPolicy retention;
+	ConsoleOutput::Mode outputMode = ConsoleOutput::Mode::Immediate;
+	std::chrono::milliseconds flushInterval(100);
+	std::string contentEncoding;
+	bool lengthFraming = false;
+	int heartbeatSend = 10000;
+	int heartbeatReceive = 10000;
+	int reconnectAttempts = 0;
+	std::chrono::milliseconds connectTimeout(10000);
+	std::chrono::milliseconds readTimeout(10000);
+	std::chrono::milliseconds writeTimeout(10000);
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string flag = argv[i];
+		std::string value = argv[i + 1];
+		if (flag == "--max-events") retention.maxEventsPerUser = std::stoul(value);
+		else if (flag == "--max-bytes") retention.maxTotalBytes = std::stoul(value);
+		else if (flag == "--max-age") retention.maxAgeSeconds = std::stoi(value);
+		else if (flag == "--spill-dir") retention.spillDir = value;
+		else if (flag == "--output") {
+			if (!ConsoleOutput::parseMode(value, outputMode)) std::cout << "Unknown output mode " << value << std::endl;
+		}
+		else if (flag == "--flush-ms") flushInterval = std::chrono::milliseconds(std::stoi(value));
+		else if (flag == "--content-encoding") contentEncoding = value;
+		else if (flag == "--framing") lengthFraming = value == "length";
+		else if (flag == "--heart-beat") {
+			size_t comma = value.find(',');
+			heartbeatSend = std::stoi(value.substr(0, comma));
+			heartbeatReceive = comma == std::string::npos ? heartbeatSend : std::stoi(value.substr(comma + 1));
+		}
+		else if (flag == "--reconnect") reconnectAttempts = std::stoi(value);
+		else if (flag == "--connect-timeout") connectTimeout = std::chrono::milliseconds(std::stoi(value));
+		else if (flag == "--read-timeout") readTimeout = std::chrono::milliseconds(std::stoi(value));
+		else if (flag == "--write-timeout") writeTimeout = std::chrono::milliseconds(std::stoi(value));
+		else std::cout << "Ignoring unknown option " << flag << std::endl;
+	}
+
 	// TODO: implement the STOMP client
+	// A command typed while a session was ending belongs to the next one.
+	std::string carried;
 	while (true) {
         const short bufsize = 1024;
-        char buf[bufsize];
-        std::cin.getline(buf, bufsize);
-        std::string line(buf);
+        std::string line;
+        if (!carried.empty()) {
+            line.swap(carried);
+        } else {
+            char buf[bufsize];
+            std::cin.getline(buf, bufsize);
+            line = buf;
+        }
         
         std::string cmd;
         size_t spacePos = line.find(' ');
@@ -37,6 +152,7 @@ int main(int argc, char *argv[]) {
             short port = std::stoi(hostPort.substr(hostPort.find(':') + 1));
 
             ConnectionHandler* handler = new ConnectionHandler(host, port);
+            handler->setTimeouts(connectTimeout, readTimeout, writeTimeout);
             if (!handler->connect()) {
                 std::cout << "Could not connect to server" << std::endl;
                 delete handler;
@@ -44,41 +160,91 @@ int main(int argc, char *argv[]) {
             }
 
             StompProtocol protocol;
+            protocol.setRetentionPolicy(retention);
+            protocol.setOutputMode(outputMode, flushInterval);
+            if (!protocol.setContentEncoding(contentEncoding))
+                protocol.output().line("Unknown content encoding " + contentEncoding + ", sending reports as is");
+            protocol.setLengthFraming(lengthFraming);
+            protocol.setHeartbeat(heartbeatSend, heartbeatReceive);
             
             protocol.processInput(line, *handler);
 
-            std::thread th([&handler, &protocol]() {
-                while (!protocol.shouldLogout()) {
-                    std::string answer;
-                    
-                    //Changed if from if (!handler->getLine(answer))
-                    if (!handler->getFrameAscii(answer,'\0')) {
-                        std::cout << "Disconnected from server." << std::endl;
-                        break;
-                    }
-
+            // One event loop thread drives the socket: frames are read with async_read_some
+            // and outgoing frames from the stdin thread are queued, so a slow write never
+            // blocks command input. Received frames go through a lock-free ring to a separate
+            // thread, so a slow console never holds up reading the socket.
+            SpscQueue<std::string> frames(FRAME_QUEUE_CAPACITY);
+            bool connectPending = true;
+            auto onFrame = [&frames, &connectPending, &handler, &protocol, lengthFraming](std::string &answer) {
+                // Settled here, before the next read.
+                if (connectPending) {
+                    connectPending = false;
+                    applyFraming(*handler, lengthFraming, answer);
+                    applyHeartbeat(*handler, protocol, answer);
+                }
+                return frames.push(answer);
+            };
+            handler->startAsync('\0', onFrame, ConnectionHandler::CloseHandler());
+            // run() returns once the connection is finished. Unless that was logout or an
+            // ERROR frame, it was lost: it is resumed on this thread, with backoff, before
+            // run() is called again. Frames read while resuming are queued first.
+            // An ERROR may still be queued when run() returns, hence the second check.
+            std::thread th([&]() {
+                handler->run();
+                int attempt = 0;
+                int delay = RECONNECT_INITIAL_DELAY_MS;
+                while (protocol.canResume() && attempt < reconnectAttempts) {
+                    attempt++;
+                    protocol.connectionLost();
+                    protocol.output().line("Connection lost, reconnecting in " + std::to_string(delay) + " ms (attempt " +
+                                           std::to_string(attempt) + " of " + std::to_string(reconnectAttempts) + ")");
+                    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+                    delay = std::min(delay * 2, RECONNECT_MAX_DELAY_MS);
+                    if (!protocol.canResume()) break;
+                    std::vector<std::string> received;
+                    if (!resumeSession(*handler, protocol, lengthFraming, received)) continue;
+                    handler->startAsync('\0', onFrame, ConnectionHandler::CloseHandler());
+                    applyHeartbeat(*handler, protocol, received.front());
+                    for (std::string &answer : received) frames.push(answer);
+                    attempt = 0;
+                    delay = RECONNECT_INITIAL_DELAY_MS;
+                    handler->run();
+                }
+                if (!protocol.shouldLogout()) protocol.connectionClosed();
+                frames.close();
+            });
+            std::thread processor([&frames, &protocol, &handler]() {
+                std::string answer;
+                while (frames.pop(answer)) {
                     if (answer.length() > 0 && answer[answer.length() - 1] == '\n') {
                         answer.resize(answer.length() - 1);
                     }
-
                     if (!protocol.processServerResponse(answer)) {
-                        break; 
+                        frames.close();
+                        handler->stopAsync();
+                        return;
                     }
                 }
+                protocol.output().line("Disconnected from server.");
             });
 
             while (!protocol.shouldLogout()) {
                 char buf2[bufsize];
                 std::cin.getline(buf2, bufsize);
                 std::string input(buf2);
-                
+                // The connection may have ended while we were waiting for input.
+                if (protocol.shouldLogout()) {
+                    carried = input;
+                    break;
+                }
                 protocol.processInput(input, *handler);
             }
 
             th.join();
+            processor.join();
             delete handler;
             
-            std::cout << "Client disconnected. Ready to login again." << std::endl;
+            protocol.output().line("Client disconnected. Ready to login again.");
         } 
         else {
             std::cout << "Error: Please login first" << std::endl;
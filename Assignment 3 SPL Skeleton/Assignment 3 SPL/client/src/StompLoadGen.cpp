@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <vector>
+#include "../include/ConnectionHandler.h"
+#include "../include/StompProtocol.h"
+#include "../include/event.h"
+#include "../include/FrameView.h"
+
+/**
+* Load generator for the STOMP server.
+* Opens N sessions on one io_service, every session joins all M channels and replays
+* the given event files through the report frame builder at a fixed rate.
+* At the end it prints throughput, SEND-to-MESSAGE latency and receipt round-trip times.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+// Receipt ids for SEND frames start here so they never collide with the
+// ids StompProtocol hands out for join/exit/logout.
+static const int SEND_RECEIPT_BASE = 1000000;
+
+// Every session must be logged in and joined to all channels by then.
+static const std::chrono::seconds SETUP_TIMEOUT(10);
+
+struct Session {
+    std::string user;
+    std::string channel;                          // where this session reports to
+    std::unique_ptr<ConnectionHandler> handler;
+    std::unique_ptr<StompProtocol> protocol;
+    std::unique_ptr<boost::asio::steady_timer> timer;
+    size_t joined;
+    size_t nextEvent;
+    std::vector<Clock::time_point> sendTimes;    // one per SEND, in order
+    std::map<int, Clock::time_point> pendingReceipts;
+    std::vector<size_t> receivedFrom;            // MESSAGE count per sender
+};
+
+struct LoadGen {
+    boost::asio::io_service io;
+    std::string hostPort;
+    std::vector<Event> events;
+    size_t sessionCount;
+    size_t channelCount;
+    size_t repeats;
+    std::chrono::microseconds interval;
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::map<std::string, size_t, std::less<>> senderIndex;
+    size_t joinedSessions;
+    size_t finishedSenders;
+    size_t messagesReceived;
+    size_t messagesExpected;
+    Clock::time_point firstSend;
+    Clock::time_point lastMessage;
+    std::vector<double> messageLatencies;        // microseconds
+    std::vector<double> receiptLatencies;        // microseconds
+    boost::asio::steady_timer doneTimer;
+    boost::asio::steady_timer setupTimer;
+
+    LoadGen() : io(), hostPort(), events(), sessionCount(0), channelCount(0), repeats(0), interval(0),
+                sessions(), senderIndex(), joinedSessions(0), finishedSenders(0), messagesReceived(0),
+                messagesExpected(0), firstSend(), lastMessage(), messageLatencies(), receiptLatencies(),
+                doneTimer(io), setupTimer(io) {}
+};
+
+static double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) return 0;
+    size_t idx = std::min(values.size() - 1, (size_t) (p * values.size()));
+    std::nth_element(values.begin(), values.begin() + idx, values.end());
+    return values[idx];
+}
+
+static void printLatency(const char *label, std::vector<double> &values) {
+    std::cout << label << " (us, n=" << values.size() << "): p50=" << percentile(values, 0.50)
+              << " p99=" << percentile(values, 0.99) << " p999=" << percentile(values, 0.999) << std::endl;
+}
+
+static void logoutAll(LoadGen &gen) {
+    for (auto &session : gen.sessions) {
+        if (session->protocol->isUserConnected())
+            session->protocol->processInput("logout", *session->handler);
+    }
+    // Give the DISCONNECT receipts a moment, then stop regardless.
+    gen.doneTimer.expires_after(std::chrono::seconds(2));
+    gen.doneTimer.async_wait([&gen](const boost::system::error_code &error) {
+        if (!error) gen.io.stop();
+    });
+}
+
+static void waitForMessages(LoadGen &gen, Clock::time_point deadline) {
+    if (gen.messagesReceived >= gen.messagesExpected || Clock::now() > deadline) {
+        logoutAll(gen);
+        return;
+    }
+    gen.doneTimer.expires_after(std::chrono::milliseconds(100));
+    gen.doneTimer.async_wait([&gen, deadline](const boost::system::error_code &error) {
+        if (!error) waitForMessages(gen, deadline);
+    });
+}
+
+static void sendNext(LoadGen &gen, Session &session) {
+    size_t total = gen.events.size() * gen.repeats;
+    if (session.nextEvent >= total) {
+        if (++gen.finishedSenders == gen.sessions.size())
+            waitForMessages(gen, Clock::now() + std::chrono::seconds(10));
+        return;
+    }
+    const Event &event = gen.events[session.nextEvent % gen.events.size()];
+    int receipt = SEND_RECEIPT_BASE + (int) session.nextEvent;
+    std::string frame = session.protocol->buildReportFrame(session.channel, event, receipt);
+    Clock::time_point now = Clock::now();
+    session.sendTimes.push_back(now);
+    session.pendingReceipts[receipt] = now;
+    session.handler->sendFrameAscii(frame, '\0');
+    session.nextEvent++;
+
+    session.timer->expires_after(gen.interval);
+    session.timer->async_wait([&gen, &session](const boost::system::error_code &error) {
+        if (!error) sendNext(gen, session);
+    });
+}
+
+static void startReporting(LoadGen &gen) {
+    gen.setupTimer.cancel();
+    gen.messagesExpected = gen.sessions.size() * gen.sessions.size() * gen.events.size() * gen.repeats;
+    gen.firstSend = Clock::now();
+    for (auto &session : gen.sessions)
+        sendNext(gen, *session);
+}
+
+// Frame callback for one session. MESSAGE frames and SEND receipts are
+// measured here, everything else goes through StompProtocol as usual.
+static bool onFrame(LoadGen &gen, Session &session, std::string &frame) {
+    Clock::time_point now = Clock::now();
+    FrameView view(frame);
+    if (view.command() == "MESSAGE") {
+        auto sender = gen.senderIndex.find(ReportBodyView(view.body()).user);
+        if (sender != gen.senderIndex.end()) {
+            size_t n = session.receivedFrom[sender->second]++;
+            const Session &from = *gen.sessions[sender->second];
+            if (n < from.sendTimes.size())
+                gen.messageLatencies.push_back(
+                        std::chrono::duration<double, std::micro>(now - from.sendTimes[n]).count());
+        }
+        gen.messagesReceived++;
+        gen.lastMessage = now;
+        return true;
+    }
+    if (view.command() == "RECEIPT") {
+        int id = atoi(std::string(view.header("receipt-id")).c_str());
+        auto pending = session.pendingReceipts.find(id);
+        if (pending != session.pendingReceipts.end()) {
+            gen.receiptLatencies.push_back(std::chrono::duration<double, std::micro>(now - pending->second).count());
+            session.pendingReceipts.erase(pending);
+            return true;
+        }
+        bool keepReading = session.protocol->processServerResponse(frame);
+        if (id < SEND_RECEIPT_BASE && ++session.joined == gen.channelCount && ++gen.joinedSessions == gen.sessions.size())
+            startReporting(gen);
+        return keepReading;
+    }
+    bool wasConnected = session.protocol->isUserConnected();
+    bool keepReading = session.protocol->processServerResponse(frame);
+    if (!wasConnected && session.protocol->isUserConnected()) {
+        for (size_t j = 0; j < gen.channelCount; j++)
+            session.protocol->processInput("join loadgen_ch" + std::to_string(j), *session.handler);
+    }
+    return keepReading;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 6) {
+        std::cerr << "Usage: " << argv[0] << " host:port sessions channels rate repeats events.json..." << std::endl
+                  << "  rate is events per second per session (0 = as fast as possible)" << std::endl;
+        return -1;
+    }
+    LoadGen gen;
+    gen.hostPort = argv[1];
+    gen.sessionCount = atoi(argv[2]);
+    gen.channelCount = std::max(1, atoi(argv[3]));
+    int rate = atoi(argv[4]);
+    gen.interval = std::chrono::microseconds(rate > 0 ? 1000000 / rate : 0);
+    gen.repeats = std::max(1, atoi(argv[5]));
+    for (int i = 6; i < argc; i++) {
+        names_and_events parsed = parseEventsFile(argv[i]);
+        gen.events.insert(gen.events.end(), parsed.events.begin(), parsed.events.end());
+    }
+    if (gen.events.empty() || gen.sessionCount == 0) {
+        std::cerr << "Nothing to send" << std::endl;
+        return 1;
+    }
+
+    std::string host = gen.hostPort.substr(0, gen.hostPort.find(':'));
+    short port = std::stoi(gen.hostPort.substr(gen.hostPort.find(':') + 1));
+
+    for (size_t i = 0; i < gen.sessionCount; i++) {
+        std::unique_ptr<Session> session(new Session{
+                "loadgen" + std::to_string(getpid()) + "_" + std::to_string(i),
+                "loadgen_ch" + std::to_string(i % gen.channelCount),
+                std::unique_ptr<ConnectionHandler>(new ConnectionHandler(host, port, gen.io)),
+                std::unique_ptr<StompProtocol>(new StompProtocol()),
+                std::unique_ptr<boost::asio::steady_timer>(new boost::asio::steady_timer(gen.io)),
+                0, 0, {}, {}, std::vector<size_t>(gen.sessionCount, 0)});
+        if (!session->handler->connect()) {
+            std::cerr << "Could not connect session " << i << std::endl;
+            return 1;
+        }
+        gen.senderIndex[session->user] = i;
+        gen.sessions.push_back(std::move(session));
+    }
+
+    for (auto &ptr : gen.sessions) {
+        Session &session = *ptr;
+        session.handler->startAsync('\0',
+            [&gen, &session](std::string &frame) { return onFrame(gen, session, frame); },
+            [&session]() { std::cerr << session.user << " disconnected from server." << std::endl; });
+        session.protocol->processInput("login " + gen.hostPort + " " + session.user + " loadgen", *session.handler);
+    }
+    // A failed login or join would otherwise leave run() waiting forever.
+    gen.setupTimer.expires_after(SETUP_TIMEOUT);
+    gen.setupTimer.async_wait([&gen](const boost::system::error_code &error) {
+        if (!error) gen.io.stop();
+    });
+
+    gen.io.run();
+
+    if (gen.joinedSessions < gen.sessions.size()) {
+        std::cerr << "Setup timed out: " << gen.joinedSessions << "/" << gen.sessions.size()
+                  << " sessions logged in and joined" << std::endl;
+        return 1;
+    }
+
+    double elapsed = std::chrono::duration<double>(gen.lastMessage - gen.firstSend).count();
+    size_t sent = 0;
+    for (auto &session : gen.sessions)
+        sent += session->sendTimes.size();
+    std::cout << "sessions=" << gen.sessionCount << " channels=" << gen.channelCount
+              << " sent=" << sent << " received=" << gen.messagesReceived << "/" << gen.messagesExpected << std::endl;
+    if (elapsed > 0)
+        std::cout << "throughput: " << sent / elapsed << " SEND frames/sec, "
+                  << gen.messagesReceived / elapsed << " MESSAGE frames/sec" << std::endl;
+    printLatency("SEND->MESSAGE latency", gen.messageLatencies);
+    printLatency("SEND receipt round-trip", gen.receiptLatencies);
+    return 0;
+}
@@ -1,34 +1,355 @@
 #include "../include/StompProtocol.h"
 #include "../include/event.h"
+#include "../include/FrameView.h"
+#include "../include/AllocCounter.h"
+#include "../include/ReportCodec.h"
 #include <iostream>
 #include <sstream>
 #include <fstream> 
 #include <algorithm> 
+#include <charconv>
+#include <cctype>
+#include <filesystem>
 
 // Constructor: Initializer list order MUST match member declaration order in .h
 StompProtocol::StompProtocol() :
     subId(0),
     receiptId(0),
     shouldTerminate(false),
-    gamesToSubs(),
-    pendingReceipts(),
     isConnected(false),
-    mapMutex(),
+    reconnecting(false),
+    disconnecting(false),
     username(""),
-    gameUpdates()
+    passcode(""),
+    subsMutex(),
+    gamesToSubs(),
+    pendingReceipts(),
+    staleReceipts(0),
+    receiptWaiters(0),
+    receiptMutex(),
+    receiptCond(),
+    receiptLatency(),
+    gamesMutex(),
+    gameUpdates(),
+    retention(),
+    storedBytes(0),
+    framesProcessed(0),
+    frameAllocations(0),
+    summaryFiles(),
+    summaryWritten(),
+    summaryMutex(),
+    summaryCond(),
+    summaryJobs(),
+    spillQueue(),
+    summaryStop(false),
+    summaryWriter(),
+    spillLogs(),
+    console(std::cout),
+    contentEncoding(),
+    decodedBody(),
+    requestLengthFraming(false),
+    heartbeatSendMs(0),
+    heartbeatReceiveMs(0)
 {
 }
 
+StompProtocol::~StompProtocol() {
+    {
+        std::lock_guard<std::mutex> lock(summaryMutex);
+        summaryStop = true;
+    }
+    summaryCond.notify_all();
+    if (summaryWriter.joinable()) summaryWriter.join();
+    // The spill logs only serve this session's summaries.
+    for (auto& [path, log] : spillLogs) {
+        log.close();
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+}
+
+void StompProtocol::setOutputMode(ConsoleOutput::Mode mode, std::chrono::milliseconds flushInterval) {
+    console.setMode(mode, flushInterval);
+}
+
+bool StompProtocol::setContentEncoding(const std::string& encoding) {
+    if (!encoding.empty() && encoding != REPORT_ENCODING) return false;
+    contentEncoding = encoding;
+    return true;
+}
+
+void StompProtocol::setLengthFraming(bool enabled) {
+    requestLengthFraming = enabled;
+}
+
+bool StompProtocol::agreesToLengthFraming(std::string_view frame) {
+    FrameView view(frame);
+    return view.command() == "CONNECTED" && view.header("framing") == "length";
+}
+
+void StompProtocol::setHeartbeat(int sendMs, int receiveMs) {
+    heartbeatSendMs = std::max(sendMs, 0);
+    heartbeatReceiveMs = std::max(receiveMs, 0);
+}
+
+bool StompProtocol::negotiateHeartbeat(std::string_view frame, std::chrono::milliseconds& sendInterval,
+                                       std::chrono::milliseconds& readTimeout) const {
+    sendInterval = readTimeout = std::chrono::milliseconds(0);
+    FrameView view(frame);
+    if (view.command() != "CONNECTED") return false;
+    // "heart-beat:sx,sy": the server sends every sx ms at best, and wants ours every sy ms.
+    std::string_view header = view.header("heart-beat");
+    size_t comma = header.find(',');
+    if (comma == std::string_view::npos) return false;
+    int serverSend = 0;
+    int serverReceive = 0;
+    std::from_chars(header.data(), header.data() + comma, serverSend);
+    std::from_chars(header.data() + comma + 1, header.data() + header.size(), serverReceive);
+    if (heartbeatSendMs > 0 && serverReceive > 0)
+        sendInterval = std::chrono::milliseconds(std::max(heartbeatSendMs, serverReceive));
+    if (heartbeatReceiveMs > 0 && serverSend > 0)
+        readTimeout = std::chrono::milliseconds(std::max(heartbeatReceiveMs, serverSend) * HEARTBEAT_TOLERANCE);
+    return sendInterval.count() > 0 || readTimeout.count() > 0;
+}
+
+void StompProtocol::setRetentionPolicy(const RetentionPolicy& policy) {
+    retention = policy;
+}
+
 bool StompProtocol::shouldLogout() {
-    return shouldTerminate;
+    return shouldTerminate.load(std::memory_order_acquire);
 }
 
 bool StompProtocol::isUserConnected() {
-    return isConnected;
+    return isConnected.load(std::memory_order_acquire);
 }
 
 void StompProtocol::setConnected(bool status) {
-    isConnected = status;
+    isConnected.store(status, std::memory_order_release);
+}
+
+std::string StompProtocol::connectFrame() const {
+    std::string frame = "CONNECT\n"
+                        "accept-version:1.2\n"
+                        "host:stomp.cs.bgu.ac.il\n"
+                        "login:" + username + "\n"
+                        "passcode:" + passcode + "\n";
+    if (requestLengthFraming) frame += "framing:length\n";
+    if (heartbeatSendMs > 0 || heartbeatReceiveMs > 0)
+        frame += "heart-beat:" + std::to_string(heartbeatSendMs) + "," + std::to_string(heartbeatReceiveMs) + "\n";
+    frame += "\n";
+    return frame;
+}
+
+bool StompProtocol::canResume() {
+    return !shouldLogout() && !disconnecting.load(std::memory_order_acquire);
+}
+
+void StompProtocol::connectionLost() {
+    reconnecting.store(true, std::memory_order_release);
+    isConnected.store(false, std::memory_order_release);
+    // Receipts that already arrived may still be queued for processing; see the CONNECTED handler.
+    staleReceipts.store(receiptId.load(std::memory_order_relaxed), std::memory_order_release);
+    wakeReceiptWaiters();
+}
+
+void StompProtocol::connectionClosed() {
+    reconnecting.store(false, std::memory_order_release);
+    shouldTerminate.store(true, std::memory_order_release);
+    isConnected.store(false, std::memory_order_release);
+    wakeReceiptWaiters();
+}
+
+std::vector<std::string> StompProtocol::resubscribeFrames(std::vector<int>& receipts) {
+    std::map<std::string, int> subscriptions;
+    {
+        std::lock_guard<std::mutex> lock(subsMutex);
+        subscriptions = gamesToSubs;
+    }
+    std::vector<std::string> frames;
+    for (const auto& subscription : subscriptions) {
+        int receipt = addReceipt(ReceiptKind::Subscribe, "Rejoined channel " + subscription.first);
+        if (receipt < 0) continue;
+        receipts.push_back(receipt);
+        frames.push_back("SUBSCRIBE\n"
+                         "destination:" + subscription.first + "\n"
+                         "id:" + std::to_string(subscription.second) + "\n"
+                         "receipt:" + std::to_string(receipt) + "\n"
+                         "\n");
+    }
+    return frames;
+}
+
+int StompProtocol::addReceipt(ReceiptKind kind, std::string action) {
+    int receipt = receiptId.fetch_add(1, std::memory_order_relaxed);
+    if (!pendingReceipts.insert(receipt, kind, std::move(action))) {
+        console.line("Error: too many receipts pending");
+        return -1;
+    }
+    return receipt;
+}
+
+// The mutex is only touched when a report is actually blocked waiting for a receipt.
+// Waiters register before checking the table, and ReceiptTable::take releases a slot
+// with a sequentially consistent store, so either they see the receipt gone or we see them.
+void StompProtocol::wakeReceiptWaiters() {
+    if (receiptWaiters.load(std::memory_order_seq_cst) == 0) return;
+    std::lock_guard<std::mutex> lock(receiptMutex);
+    receiptCond.notify_all();
+}
+
+std::shared_ptr<GameUpdates> StompProtocol::getGame(std::string_view gameName, bool create) {
+    std::lock_guard<std::mutex> lock(gamesMutex);
+    auto it = gameUpdates.find(gameName);
+    if (it != gameUpdates.end()) return it->second;
+    if (!create) return nullptr;
+    std::shared_ptr<GameUpdates> game = std::make_shared<GameUpdates>();
+    gameUpdates.emplace(std::string(gameName), game);
+    return game;
+}
+
+// Heap footprint of a stored event, used for the byte limit.
+static size_t eventBytes(const Event& e) {
+    return sizeof(Event) + e.heap_bytes();
+}
+
+void StompProtocol::evictFront(UserReports& reports, std::string_view gameName, std::string_view user) {
+    storedBytes -= eventBytes(reports.events.front());
+    spillEvent(reports, gameName, user, std::move(reports.events.front()));
+    reports.events.pop_front();
+}
+
+void StompProtocol::applyRetention(GameUpdates& game, std::string_view gameName, std::string_view user) {
+    UserReports& own = game.byUser.find(user)->second;
+    std::deque<Event>& events = own.events;
+
+    while (retention.maxEventsPerUser > 0 && events.size() > retention.maxEventsPerUser) {
+        evictFront(own, gameName, user);
+    }
+    if (retention.maxAgeSeconds > 0 && !events.empty()) {
+        int cutoff = events.back().get_time() - retention.maxAgeSeconds;
+        while (events.size() > 1 && events.front().get_time() < cutoff) {
+            evictFront(own, gameName, user);
+        }
+    }
+}
+
+// The games that have gone longest without an update give up their events first, oldest first
+// within a game, so a game that filled the budget and went quiet cannot starve the ones still
+// being reported. Game locks are taken one at a time. The user who just reported to updated
+// keeps at least that report.
+void StompProtocol::applyByteLimit(const GameUpdates* updated, std::string_view user) {
+    if (retention.maxTotalBytes == 0 || storedBytes <= retention.maxTotalBytes) return;
+    // Games are never removed during a session, so the names stay valid.
+    std::vector<std::pair<const std::string*, std::shared_ptr<GameUpdates>>> games;
+    {
+        std::lock_guard<std::mutex> lock(gamesMutex);
+        games.reserve(gameUpdates.size());
+        for (auto& [name, game] : gameUpdates) games.emplace_back(&name, game);
+    }
+    std::sort(games.begin(), games.end(), [](const auto& a, const auto& b) {
+        return a.second->lastUpdate < b.second->lastUpdate; });
+
+    for (auto& [gameName, game] : games) {
+        std::lock_guard<std::mutex> lock(game->mutex);
+        while (storedBytes > retention.maxTotalBytes) {
+            UserReports* oldest = nullptr;
+            const std::string* owner = nullptr;
+            for (auto& [name, reports] : game->byUser) {
+                if (reports.events.empty() || (game.get() == updated && name == user && reports.events.size() == 1))
+                    continue;
+                if (oldest == nullptr || reports.events.front().get_time() < oldest->events.front().get_time()) {
+                    oldest = &reports;
+                    owner = &name;
+                }
+            }
+            if (oldest == nullptr) break;
+            evictFront(*oldest, *gameName, *owner);
+        }
+        if (storedBytes <= retention.maxTotalBytes) return;
+    }
+}
+
+// Every byte but letters, digits and '-' becomes "_XX" in hex, so distinct names never share
+// a file and "__" can only be the separator.
+static void appendEscaped(std::string& out, std::string_view name) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (char c : name) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (isalnum(byte) || c == '-') {
+            out += c;
+        } else {
+            out += '_';
+            out += hex[byte >> 4];
+            out += hex[byte & 0xF];
+        }
+    }
+}
+
+std::string StompProtocol::spillPath(std::string_view gameName, std::string_view user) const {
+    std::string path = retention.spillDir + "/";
+    appendEscaped(path, gameName);
+    path += "__";
+    appendEscaped(path, user);
+    return path + ".log";
+}
+
+// Spill log record: "time lenA lenB lenName lenDescription\n" followed by the raw fields.
+// spilledBytes counts the record as soon as it is queued: the summary writer writes it out
+// before it runs any summary job queued after this, and a record lost to a failed write only
+// leaves readSpilled with less to read.
+void StompProtocol::spillEvent(UserReports& reports, std::string_view gameName, std::string_view user,
+                               Event event) {
+    if (retention.spillDir.empty()) return;
+    std::string header = std::to_string(event.get_time()) + " " +
+                         std::to_string(event.get_team_a_name().size()) + " " +
+                         std::to_string(event.get_team_b_name().size()) + " " +
+                         std::to_string(event.get_name().size()) + " " +
+                         std::to_string(event.get_discription().size()) + "\n";
+    reports.spilledBytes += header.size() + event.get_team_a_name().size() + event.get_team_b_name().size() +
+                            event.get_name().size() + event.get_discription().size();
+    {
+        std::lock_guard<std::mutex> lock(summaryMutex);
+        spillQueue.push_back(SpillRecord{spillPath(gameName, user), std::move(header), std::move(event)});
+        if (!summaryWriter.joinable()) summaryWriter = std::thread(&StompProtocol::runSummaryWriter, this);
+    }
+    summaryCond.notify_one();
+}
+
+// Each log stays open, buffered, for the whole session. readSpilled reads from the start of the log,
+// so the first record of this session replaces whatever an earlier session left there.
+void StompProtocol::writeSpilled(std::deque<SpillRecord>& records) {
+    for (const SpillRecord& record : records) {
+        auto log = spillLogs.find(record.path);
+        if (log == spillLogs.end()) {
+            log = spillLogs.emplace(record.path, std::ofstream(record.path, std::ios::trunc | std::ios::binary)).first;
+        }
+        const Event& event = record.event;
+        log->second << record.header << event.get_team_a_name() << event.get_team_b_name() << event.get_name()
+                    << event.get_discription();
+    }
+}
+
+std::vector<Event> StompProtocol::readSpilled(std::string_view gameName, std::string_view user,
+                                              size_t byteLimit) {
+    std::vector<Event> events;
+    if (byteLimit == 0) return events;
+    std::string path = spillPath(gameName, user);
+    auto written = spillLogs.find(path);
+    if (written != spillLogs.end()) written->second.flush();
+    std::ifstream log(path, std::ios::binary);
+    UpdateList none;
+    while (log && static_cast<size_t>(log.tellg()) < byteLimit) {
+        int time;
+        size_t lenA, lenB, lenName, lenDescription;
+        if (!(log >> time >> lenA >> lenB >> lenName >> lenDescription) || log.get() != '\n') break;
+        std::string fields(lenA + lenB + lenName + lenDescription, '\0');
+        if (!log.read(&fields[0], fields.size())) break;
+        std::string_view text = fields;
+        events.emplace_back(text.substr(0, lenA), text.substr(lenA, lenB), text.substr(lenA + lenB, lenName),
+                            time, none, none, none, text.substr(lenA + lenB + lenName));
+    }
+    return events;
 }
 
 // Helper function to split strings
@@ -42,52 +363,120 @@ std::vector<std::string> StompProtocol::split(const std::string& s, char delimit
     return tokens;
 }
 
+std::string StompProtocol::buildReportFrame(const std::string& destination, const Event& event, int receipt) {
+    std::string body = "user:" + username + "\n";
+    body.append("team a:").append(event.get_team_a_name()).append("\n");
+    body.append("team b:").append(event.get_team_b_name()).append("\n");
+    body.append("event name:").append(event.get_name()).append("\n");
+    body += "time:" + std::to_string(event.get_time()) + "\n" +
+            "general game updates:\n";
+
+    for (auto const& [key, val] : event.get_game_updates()) {
+        body.append(key).append(":").append(val).append("\n");
+    }
+    body += "team a updates:\n";
+    for (auto const& [key, val] : event.get_team_a_updates()) {
+        body.append(key).append(":").append(val).append("\n");
+    }
+    body += "team b updates:\n";
+    for (auto const& [key, val] : event.get_team_b_updates()) {
+        body.append(key).append(":").append(val).append("\n");
+    }
+    body.append("description:\n").append(event.get_discription());
+
+    std::string encoded;
+    bool compressed = !contentEncoding.empty() && compressReportBody(body, encoded);
+
+    std::string frame = "SEND\n"
+                        "destination:" + destination + "\n";
+    if (receipt >= 0) {
+        frame += "receipt:" + std::to_string(receipt) + "\n";
+    }
+    if (compressed) {
+        frame += "content-encoding:" + contentEncoding + "\n";
+    }
+    frame += "\n" + (compressed ? encoded : body) + "\n";
+    return frame;
+}
+
+// Sends one window of report frames with a receipt on the last one.
+// At most REPORT_WINDOWS_IN_FLIGHT windows may be unacknowledged; beyond that we wait for the
+// server to catch up. Returns false if the report has to be aborted.
+bool StompProtocol::sendReportWindow(ConnectionHandler& handler, const std::string& gameName,
+                                     const std::vector<Event>& window, std::vector<int>& windowReceipts,
+                                     const std::string& completion) {
+    // A lost connection refuses frames anyway; stop rather than send into a resumed session.
+    if (!isUserConnected()) return false;
+    if (windowReceipts.size() >= REPORT_WINDOWS_IN_FLIGHT) {
+        int oldest = windowReceipts[windowReceipts.size() - REPORT_WINDOWS_IN_FLIGHT];
+        receiptWaiters.fetch_add(1, std::memory_order_seq_cst);
+        bool resolved;
+        {
+            std::unique_lock<std::mutex> lock(receiptMutex);
+            resolved = receiptCond.wait_for(lock, std::chrono::seconds(REPORT_RECEIPT_TIMEOUT_SEC), [&]() {
+                return !pendingReceipts.contains(oldest) || !isUserConnected(); });
+        }
+        receiptWaiters.fetch_sub(1, std::memory_order_relaxed);
+        if (!resolved) {
+            console.line("Report aborted: no receipt from server");
+            return false;
+        }
+        if (!isUserConnected()) return false;
+    }
+
+    // The receipt's send time is taken after the rest of the window is encoded, so its
+    // round trip measures the server rather than our own frame building.
+    std::vector<std::string> frames;
+    frames.reserve(window.size());
+    for (size_t i = 0; i + 1 < window.size(); i++) {
+        frames.push_back(buildReportFrame(gameName, window[i]));
+    }
+    int receipt = addReceipt(ReceiptKind::Send, completion);
+    if (receipt < 0) return false;
+    windowReceipts.push_back(receipt);
+    frames.push_back(buildReportFrame(gameName, window.back(), receipt));
+    return handler.sendFrameAscii(frames, '\0');
+}
+
 void StompProtocol::processInput(std::string line, ConnectionHandler& handler) {
     std::vector<std::string> tokens = split(line, ' ');
     if (tokens.empty()) return;
 
     std::string command = tokens[0];
 
+    if (reconnecting.load(std::memory_order_acquire)) {
+        console.line("Reconnecting to server, try again shortly");
+        return;
+    }
     if (command == "login") {
-        if (isConnected) {
-            std::cout << "The client is already logged in, log out before trying again" << std::endl;
+        if (isUserConnected()) {
+            console.line("The client is already logged in, log out before trying again");
             return;
         }
         if (tokens.size() < 4) {
-            std::cout << "Usage: login {host:port} {username} {password}" << std::endl;
+            console.line("Usage: login {host:port} {username} {password}");
             return;
         }
         username = tokens[2];
-        std::string passcode = tokens[3];
-        
-        std::string frame = "CONNECT\n"
-                            "accept-version:1.2\n"
-                            "host:stomp.cs.bgu.ac.il\n"
-                            "login:" + username + "\n"
-                            "passcode:" + passcode + "\n"
-                            "\n";
-        handler.sendFrameAscii(frame, '\0');
+        passcode = tokens[3];
+        handler.sendFrameAscii(connectFrame(), '\0');
     }
-    else if (!isConnected) {
-        std::cout << "Please login first" << std::endl;
+    else if (!isUserConnected()) {
+        console.line("Please login first");
         return;
     }
     else if (command == "join") {
         if (tokens.size() < 2) return;
         std::string gameName = tokens[1];
         
-        int id = subId++;
+        int receipt = addReceipt(ReceiptKind::Subscribe, "Joined channel " + gameName);
+        if (receipt < 0) return;
+        int id = subId.fetch_add(1, std::memory_order_relaxed);
         {
-            std::lock_guard<std::mutex> lock(mapMutex);
+            std::lock_guard<std::mutex> lock(subsMutex);
             gamesToSubs[gameName] = id;
         }
 
-        int receipt = receiptId++;
-        {
-             std::lock_guard<std::mutex> lock(mapMutex);
-             pendingReceipts[receipt] = "Joined channel " + gameName;
-        }
-
         std::string frame = "SUBSCRIBE\n"
                             "destination:" + gameName + "\n"
                             "id:" + std::to_string(id) + "\n"
@@ -101,7 +490,7 @@ void StompProtocol::processInput(std::string line, ConnectionHandler& handler) {
         
         int id = -1;
         {
-            std::lock_guard<std::mutex> lock(mapMutex);
+            std::lock_guard<std::mutex> lock(subsMutex);
             if (gamesToSubs.count(gameName)) {
                 id = gamesToSubs[gameName];
                 gamesToSubs.erase(gameName); // Erase optimistically, or wait for receipt
@@ -110,11 +499,8 @@ void StompProtocol::processInput(std::string line, ConnectionHandler& handler) {
         
         if (id == -1) return; // Not subscribed
 
-        int receipt = receiptId++;
-        {
-             std::lock_guard<std::mutex> lock(mapMutex);
-             pendingReceipts[receipt] = "Exited channel " + gameName;
-        }
+        int receipt = addReceipt(ReceiptKind::Unsubscribe, "Exited channel " + gameName);
+        if (receipt < 0) return;
 
         std::string frame = "UNSUBSCRIBE\n"
                             "id:" + std::to_string(id) + "\n"
@@ -123,12 +509,10 @@ void StompProtocol::processInput(std::string line, ConnectionHandler& handler) {
         handler.sendFrameAscii(frame, '\0');
     }
     else if (command == "logout") {
-        int receipt = receiptId++;
-        {
-             std::lock_guard<std::mutex> lock(mapMutex);
-             pendingReceipts[receipt] = "DISCONNECT";
-        }
-        
+        int receipt = addReceipt(ReceiptKind::Disconnect, "DISCONNECT");
+        if (receipt < 0) return;
+        disconnecting.store(true, std::memory_order_release);
+
         std::string frame = "DISCONNECT\n"
                             "receipt:" + std::to_string(receipt) + "\n"
                             "\n";
@@ -137,158 +521,405 @@ void StompProtocol::processInput(std::string line, ConnectionHandler& handler) {
     else if (command == "report") {
         if (tokens.size() < 2) return;
         std::string filename = tokens[1];
-        names_and_events parsed = parseEventsFile(filename); // From event.h
-
-        // Send events one by one
-        for (const Event& event : parsed.events) {
-             std::string gameName = parsed.team_a_name + "_" + parsed.team_b_name;
-
-             std::string body = "user:" + username + "\n" +
-                                "team a:" + parsed.team_a_name + "\n" +
-                                "team b:" + parsed.team_b_name + "\n" +
-                                "event name:" + event.get_name() + "\n" +
-                                "time:" + std::to_string(event.get_time()) + "\n" +
-                                "general game updates:\n";
-                                
-             for (auto const& [key, val] : event.get_game_updates()) {
-                 body += key + ":" + val + "\n";
-             }
-             body += "team a updates:\n";
-             for (auto const& [key, val] : event.get_team_a_updates()) {
-                 body += key + ":" + val + "\n";
-             }
-             body += "team b updates:\n";
-             for (auto const& [key, val] : event.get_team_b_updates()) {
-                 body += key + ":" + val + "\n";
-             }
-             body += "description:\n" + event.get_discription();
-
-             std::string frame = "SEND\n"
-                                 "destination:" + gameName + "\n"
-                                 "\n" + 
-                                 body + "\n";
-             
-             handler.sendFrameAscii(frame, '\0');
+
+        // Events are streamed out of the file and go out in windows of REPORT_WINDOW frames,
+        // each window as one gather write. A full window is only flushed once the next event
+        // shows up, so the final window always exists to carry the completion receipt.
+        std::vector<Event> window;
+        std::vector<int> windowReceipts;
+        std::string gameName;
+        size_t reported = 0;
+        bool aborted = false;
+        try {
+            streamEventsFile(filename, [&](const Event& event) {
+                if (window.size() == REPORT_WINDOW) {
+                    if (!sendReportWindow(handler, gameName, window, windowReceipts, "")) {
+                        aborted = true;
+                        return false;
+                    }
+                    window.clear();
+                }
+                gameName.assign(event.get_team_a_name()).append("_").append(event.get_team_b_name());
+                window.push_back(event);
+                reported++;
+                return true;
+            });
+        }
+        catch (const std::exception& e) {
+            console.line("Error: could not read " + filename + " (" + e.what() + ")");
+            return;
+        }
+        if (!aborted && !window.empty()) {
+            sendReportWindow(handler, gameName, window, windowReceipts,
+                             "Reported " + std::to_string(reported) + " events to " + gameName);
         }
     }
+    else if (command == "stats") {
+        static const char* const kindNames[] = {"SUBSCRIBE", "UNSUBSCRIBE", "DISCONNECT", "SEND"};
+        std::ostringstream out;
+        out << "Receipt round-trip times (us):";
+        for (size_t kind = 0; kind < receiptLatency.size(); kind++) {
+            const LatencyHistogram& latency = receiptLatency[kind];
+            out << "\n" << kindNames[kind] << ": n=" << latency.count();
+            if (latency.count() > 0) {
+                out << " p50=" << latency.percentile(0.50) << " p90=" << latency.percentile(0.90)
+                    << " p99=" << latency.percentile(0.99) << " p999=" << latency.percentile(0.999)
+                    << " max=" << latency.max();
+            }
+        }
+        console.line(out.str());
+    }
+    else if (command == "allocs") {
+        if (!ALLOCATIONS_COUNTED) {
+            console.line("Allocations are not counted in this build, see COUNT_ALLOCS in the makefile");
+            return;
+        }
+        std::ostringstream out;
+        out << "Heap allocations per received frame: " << allocationsPerFrame();
+        console.line(out.str());
+    }
     else if (command == "summary") {
         if (tokens.size() < 4) {
-            std::cout << "Usage: summary {gameName} {user} {file}" << std::endl;
+            console.line("Usage: summary {gameName} {user} {file}");
             return;
         }
         std::string gameName = tokens[1];
         std::string user = tokens[2];
         std::string fileName = tokens[3];
 
-        std::lock_guard<std::mutex> lock(mapMutex);
-        
-        if (gameUpdates.count(gameName) && gameUpdates[gameName].count(user)) {
-            std::ofstream outFile(fileName); 
-            
-            if (outFile.is_open()) {
-                Event& firstEvent = gameUpdates[gameName][user][0];
-                outFile << firstEvent.get_team_a_name() << " vs " << firstEvent.get_team_b_name() << "\n";
-                outFile << "Game event reports:\n";
-                
-                for (const Event& e : gameUpdates[gameName][user]) {
-                    outFile << e.get_time() << " - " << e.get_name() << ":\n\n";
-                    outFile << e.get_discription() << "\n\n"; 
-                }
-                
-                outFile.close();
-                std::cout << "Summary created in " << fileName << std::endl;
-            } else {
-                std::cout << "Error: Could not open file " << fileName << std::endl;
-            }
-        } else {
-            std::cout << "No reports found for " << user << " in game " << gameName << std::endl;
+        // Only the in-memory copy happens here; the file is written by the summary writer thread,
+        // which prints when it is done.
+        SummaryJob job{gameName, user, fileName, SummarySnapshot()};
+        size_t written = summaryEventsWritten(fileName, gameName, user);
+        if (!takeSummarySnapshot(gameName, user, job.snapshot, written) || job.snapshot.added == 0) {
+            console.line("No reports found for " + user + " in game " + gameName);
+            return;
         }
+        queueSummary(std::move(job));
     }
 }
 
-bool StompProtocol::processServerResponse(std::string frame) {
-    std::vector<std::string> lines = split(frame, '\n');
-    if (lines.empty()) return true;
+bool StompProtocol::takeSummarySnapshot(const std::string& gameName, const std::string& user,
+                                        SummarySnapshot& snapshot, size_t written) {
+    std::shared_ptr<GameUpdates> game = getGame(gameName, false);
+    if (!game) return false;
+    std::lock_guard<std::mutex> lock(game->mutex);
+    auto found = game->byUser.find(user);
+    if (found == game->byUser.end()) return false;
+    const UserReports& reports = found->second;
+
+    snapshot.teamA = reports.teamA;
+    snapshot.teamB = reports.teamB;
+    snapshot.generalStats = reports.generalStats;
+    snapshot.teamAStats = reports.teamAStats;
+    snapshot.teamBStats = reports.teamBStats;
+    // Same test as the writer's for appending; copying the whole history under the lock the
+    // network thread needs is left for when the file has to be rewritten anyway.
+    size_t fresh = reports.added - written;
+    snapshot.partial = written > 0 && reports.reorderedAt <= written && written <= reports.added &&
+                       fresh <= reports.events.size();
+    if (snapshot.partial) snapshot.events.assign(reports.events.end() - fresh, reports.events.end());
+    else snapshot.events.assign(reports.events.begin(), reports.events.end());
+    snapshot.added = reports.added;
+    snapshot.reorderedAt = reports.reorderedAt;
+    snapshot.spilledBytes = reports.spilledBytes;
+    return true;
+}
 
-    std::string command = lines[0];
+void StompProtocol::queueSummary(SummaryJob job) {
+    {
+        std::lock_guard<std::mutex> lock(summaryMutex);
+        summaryJobs.push_back(std::move(job));
+        if (!summaryWriter.joinable()) summaryWriter = std::thread(&StompProtocol::runSummaryWriter, this);
+    }
+    summaryCond.notify_one();
+}
+
+// Jobs run in the order they were queued, so summaries into the same file never race.
+// Spilled events queued before a job are written before it runs. On shutdown the queues are drained first.
+void StompProtocol::runSummaryWriter() {
+    std::deque<SpillRecord> spills;
+    std::unique_lock<std::mutex> lock(summaryMutex);
+    while (true) {
+        summaryCond.wait(lock, [this] { return summaryStop || !summaryJobs.empty() || !spillQueue.empty(); });
+        if (!spillQueue.empty()) {
+            spills.swap(spillQueue);
+            lock.unlock();
+            writeSpilled(spills);
+            spills.clear();
+            lock.lock();
+            continue;
+        }
+        if (summaryJobs.empty()) return;
+        SummaryJob job = std::move(summaryJobs.front());
+        summaryJobs.pop_front();
+        lock.unlock();
+        writeSummaryFile(job);
+        lock.lock();
+    }
+}
+
+std::string StompProtocol::summaryHeader(const SummarySnapshot& snapshot) const {
+    std::ostringstream out;
+    out << snapshot.teamA << " vs " << snapshot.teamB << "\n";
+    out << "Game stats:\n";
+    out << "General stats:\n";
+    for (auto const& [key, val] : snapshot.generalStats) out << key << ": " << val << "\n";
+    out << snapshot.teamA << " stats:\n";
+    for (auto const& [key, val] : snapshot.teamAStats) out << key << ": " << val << "\n";
+    out << snapshot.teamB << " stats:\n";
+    for (auto const& [key, val] : snapshot.teamBStats) out << key << ": " << val << "\n";
+    out << "Game event reports:\n";
+    return out.str();
+}
+
+void StompProtocol::appendSummaryEvents(std::string& out, std::vector<Event>::const_iterator first,
+                                        std::vector<Event>::const_iterator last) const {
+    for (; first != last; ++first) {
+        out += std::to_string(first->get_time());
+        out += " - ";
+        out += first->get_name();
+        out += ":\n\n";
+        out += first->get_discription();
+        out += "\n\n";
+    }
+}
+
+size_t StompProtocol::summaryEventsWritten(const std::string& fileName, const std::string& gameName,
+                                          const std::string& user) {
+    std::lock_guard<std::mutex> lock(summaryMutex);
+    auto found = summaryWritten.find(fileName);
+    if (found == summaryWritten.end() || found->second.gameName != gameName || found->second.user != user) return 0;
+    return found->second.eventsWritten;
+}
+
+void StompProtocol::recordSummaryWritten(const std::string& fileName, const SummaryFileState* state) {
+    std::lock_guard<std::mutex> lock(summaryMutex);
+    if (state != nullptr) summaryWritten[fileName] = *state;
+    else summaryWritten.erase(fileName);
+}
+
+// Puts header in place of the first headerBytes of a summary file of size fileSize, and appends tail.
+// A header of the same size is written over the old one. Otherwise the events already in the file
+// are read back and written again behind the new header, which still spares formatting them and
+// reading the spill log. Returns the new size of the file, or 0 if it could not be updated.
+static uintmax_t updateSummaryFile(const std::string& fileName, size_t headerBytes, uintmax_t fileSize,
+                                   const std::string& header, const std::string& tail) {
+    std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file.is_open() || fileSize < headerBytes) return 0;
+    if (header.size() == headerBytes) {
+        file.write(header.data(), header.size());
+        file.seekp(0, std::ios::end);
+        file.write(tail.data(), tail.size());
+        return file ? fileSize + tail.size() : 0;
+    }
+    std::string content = header;
+    content.resize(header.size() + (fileSize - headerBytes));
+    file.seekg(headerBytes);
+    if (!file.read(&content[header.size()], fileSize - headerBytes)) return 0;
+    file.close();
+    content += tail;
+    std::ofstream outFile(fileName, std::ios::trunc | std::ios::binary);
+    outFile.write(content.data(), content.size());
+    return outFile ? content.size() : 0;
+}
+
+// Writing the same game and user into the same file again only updates the header and appends
+// the events added since; anything else rewrites the file. The file always ends up exactly as a
+// rewrite would leave it, and is built in memory and handed to the stream in large writes.
+void StompProtocol::writeSummaryFile(SummaryJob& job) {
+    SummarySnapshot& snapshot = job.snapshot;
+    SummaryFileState& state = summaryFiles[job.fileName];
+    std::error_code error;
+    uintmax_t onDisk = std::filesystem::file_size(job.fileName, error);
+    size_t since = state.eventsWritten;
+    // Appending is only possible if no late event landed before what was written,
+    // and everything new is still in memory.
+    bool incremental = !error && onDisk == state.fileSize && state.gameName == job.gameName &&
+                       state.user == job.user && since > 0 && snapshot.reorderedAt <= since &&
+                       since <= snapshot.added && snapshot.added - since <= snapshot.events.size();
+
+    if (incremental) {
+        std::string header = summaryHeader(snapshot);
+        std::string tail;
+        appendSummaryEvents(tail, snapshot.events.end() - (snapshot.added - since), snapshot.events.end());
+        uintmax_t size = updateSummaryFile(job.fileName, state.headerBytes, state.fileSize, header, tail);
+        if (size > 0) {
+            state.eventsWritten = snapshot.added;
+            state.headerBytes = header.size();
+            state.fileSize = size;
+            recordSummaryWritten(job.fileName, &state);
+            console.line("Summary created in " + job.fileName);
+            return;
+        }
+        // The file could not be updated: start over with all events.
+    }
+    // A partial snapshot was taken expecting to append; a rewrite needs every event.
+    if (snapshot.partial && !takeSummarySnapshot(job.gameName, job.user, snapshot)) {
+        summaryFiles.erase(job.fileName);
+        recordSummaryWritten(job.fileName, nullptr);
+        console.line("No reports found for " + job.user + " in game " + job.gameName);
+        return;
+    }
+
+    std::string content = summaryHeader(snapshot);
+    size_t headerBytes = content.size();
+    // Evicted events come first from the spill log, up to the size seen when the snapshot was taken.
+    if (snapshot.spilledBytes > 0) {
+        std::vector<Event> older = readSpilled(job.gameName, job.user, snapshot.spilledBytes);
+        appendSummaryEvents(content, older.begin(), older.end());
+    }
+    appendSummaryEvents(content, snapshot.events.begin(), snapshot.events.end());
+
+    std::ofstream outFile(job.fileName, std::ios::trunc | std::ios::binary);
+    if (outFile.is_open()) {
+        outFile.write(content.data(), content.size());
+        outFile.close();
+        state.gameName = job.gameName;
+        state.user = job.user;
+        state.eventsWritten = snapshot.added;
+        state.headerBytes = headerBytes;
+        state.fileSize = content.size();
+        recordSummaryWritten(job.fileName, &state);
+        console.line("Summary created in " + job.fileName);
+    } else {
+        summaryFiles.erase(job.fileName);
+        recordSummaryWritten(job.fileName, nullptr);
+        console.line("Error: Could not open file " + job.fileName);
+    }
+}
+
+void UserReports::add(Event event) {
+    if (teamA.empty()) {
+        teamA = event.get_team_a_name();
+        teamB = event.get_team_b_name();
+    }
+    // A report older than the newest one only fills in stats nobody has reported yet.
+    bool late = !events.empty() && event.get_time() < events.back().get_time();
+    added++;
+    if (late) reorderedAt = added;
+    auto fold = [late](UpdateList& stats, const UpdateListView& updates) {
+        for (auto const& [key, val] : updates) {
+            if (!late || stats.find(key) == nullptr) stats.set(key, val);
+        }
+    };
+    fold(generalStats, event.get_game_updates());
+    fold(teamAStats, event.get_team_a_updates());
+    fold(teamBStats, event.get_team_b_updates());
+
+    // Reports normally arrive in time order; a late one is slotted into place.
+    auto pos = events.end();
+    while (pos != events.begin() && std::prev(pos)->get_time() > event.get_time()) --pos;
+    events.insert(pos, std::move(event));
+}
+
+// Adds the heap allocations made while handling one frame to the protocol's counters.
+class FrameAllocationScope {
+private:
+    std::atomic<size_t>& frames;
+    std::atomic<size_t>& allocations;
+    size_t before;
+
+public:
+    FrameAllocationScope(std::atomic<size_t>& frames, std::atomic<size_t>& allocations) :
+        frames(frames), allocations(allocations), before(threadAllocations()) {}
+    ~FrameAllocationScope() {
+        frames++;
+        allocations += threadAllocations() - before;
+    }
+    FrameAllocationScope(const FrameAllocationScope&) = delete;
+    FrameAllocationScope& operator=(const FrameAllocationScope&) = delete;
+};
+
+ConsoleOutput& StompProtocol::output() {
+    return console;
+}
+
+double StompProtocol::allocationsPerFrame() const {
+    size_t frames = framesProcessed;
+    return frames == 0 ? 0.0 : (double) frameAllocations / frames;
+}
+
+bool StompProtocol::processServerResponse(const std::string& frame) {
+    FrameAllocationScope allocationScope(framesProcessed, frameAllocations);
+    FrameView view(frame);
+    std::string_view command = view.command();
+    if (command.empty()) return true;
 
     if (command == "CONNECTED") {
-        isConnected = true;
-        std::cout << "Login successful" << std::endl;
+        isConnected.store(true, std::memory_order_release);
+        bool resumed = reconnecting.exchange(false, std::memory_order_acq_rel);
+        // Every frame of the lost connection has been handled by now; what is left of its
+        // receipts will never come. The resubscribe receipts were handed out after it was lost.
+        if (resumed) pendingReceipts.clearBefore(staleReceipts.load(std::memory_order_acquire));
+        console.line(resumed ? "Reconnected to server" : "Login successful");
     }
     else if (command == "ERROR") {
-        std::cout << frame << std::endl; 
-        shouldTerminate = true;
-        isConnected = false;
+        console.line(frame);
+        shouldTerminate.store(true, std::memory_order_release);
+        isConnected.store(false, std::memory_order_release);
+        reconnecting.store(false, std::memory_order_release);
+        wakeReceiptWaiters();
         return false;
     }
     else if (command == "MESSAGE") {
-        std::string dest = "";
-        std::string body = "";
-        bool bodyStarted = false;
-        
-        for (size_t i = 1; i < lines.size(); i++) {
-            if (!bodyStarted && lines[i].find("destination:") == 0) {
-                dest = lines[i].substr(12);
-                if (!dest.empty() && dest.back() == '\r') dest.pop_back();
-            }
-            else if (!bodyStarted && lines[i].empty()) {
-                bodyStarted = true;
-            }
-            else if (bodyStarted) {
-                body += lines[i] + "\n";
+        std::string_view dest = view.header("destination");
+        std::string_view body = view.body();
+        std::string_view encoding = view.header("content-encoding");
+        if (!encoding.empty()) {
+            if (encoding != REPORT_ENCODING || !decompressReportBody(body, decodedBody)) {
+                console.line("Error: could not decode update from " + std::string(dest));
+                return true;
             }
+            body = decodedBody;
         }
+        ReportBodyView report(body);
 
-        std::string sender = "", team_a = "", team_b = "", event_name = "";
-        int event_time = 0;
-        std::vector<std::string> bodyLines = split(body, '\n');
-        
-        for (std::string& line : bodyLines) {
-            if (!line.empty() && line.back() == '\r') line.pop_back(); 
-            
-            if (line.find("user:") == 0) sender = line.substr(5);
-            else if (line.find("team a:") == 0) team_a = line.substr(7);
-            else if (line.find("team b:") == 0) team_b = line.substr(7);
-            else if (line.find("event name:") == 0) event_name = line.substr(11);
-            else if (line.find("time:") == 0) event_time = std::stoi(line.substr(5));
+        if (!report.user.empty()) {
+            Event newEvent(report);
+            std::shared_ptr<GameUpdates> game = getGame(dest, true);
+            {
+                std::lock_guard<std::mutex> lock(game->mutex);
+                storedBytes += eventBytes(newEvent);
+                game->lastUpdate = framesProcessed.load(std::memory_order_relaxed);
+                auto reports = game->byUser.find(report.user);
+                if (reports == game->byUser.end()) reports = game->byUser.emplace(std::string(report.user), UserReports()).first;
+                reports->second.add(std::move(newEvent));
+                applyRetention(*game, dest, report.user);
+            }
+            applyByteLimit(game.get(), report.user);
         }
-
-        if (!sender.empty()) {
-            std::lock_guard<std::mutex> lock(mapMutex);
-            std::map<std::string, std::string> empty_map;
-            Event newEvent(team_a, team_b, event_name, event_time, empty_map, empty_map, empty_map, body);
-            gameUpdates[dest][sender].push_back(newEvent);
+        if (console.mode() == ConsoleOutput::Mode::Compact) {
+            char time[16];
+            std::to_chars_result end = std::to_chars(time, time + sizeof(time), report.time);
+            console.update({dest, ": ", report.user, " @ ", std::string_view(time, end.ptr - time), " - ",
+                            report.event_name, "\n"});
+        } else {
+            bool newline = body.empty() || body.back() != '\n';
+            console.update({"Displaying update from: ", dest, "\n", body, newline ? "\n\n" : "\n"});
         }
-        std::cout << "Displaying update from: " << dest << "\n" << body << std::endl;
     }
     else if (command == "RECEIPT") {
-        std::string receiptId = "";
-        if (lines.size() > 1) {
-                size_t colonPos = lines[1].find(':');
-                if (colonPos != std::string::npos) {
-                    receiptId = lines[1].substr(colonPos + 1); 
+        std::string_view receiptId = view.header("receipt-id");
+        int rId = 0;
+        if (!receiptId.empty() &&
+            std::from_chars(receiptId.data(), receiptId.data() + receiptId.size(), rId).ec == std::errc()) {
+            PendingReceipt pending;
+            if (pendingReceipts.take(rId, pending)) {
+                auto roundTrip = std::chrono::steady_clock::now() - pending.sentAt;
+                receiptLatency[static_cast<size_t>(pending.kind)].record(
+                    std::chrono::duration_cast<std::chrono::microseconds>(roundTrip).count());
+                const std::string& action = pending.action;
+                if (pending.kind == ReceiptKind::Disconnect) {
+                    shouldTerminate.store(true, std::memory_order_release);
+                    isConnected.store(false, std::memory_order_release);
+                    return false;
                 }
+
+                if (!action.empty()) console.line(action);
+                wakeReceiptWaiters();
             }
-        
-            if (!receiptId.empty()) {
-                try {
-                    int rId = std::stoi(receiptId);
-                    std::lock_guard<std::mutex> lock(mapMutex);
-                    if (pendingReceipts.count(rId)) {
-                        std::string action = pendingReceipts[rId];
-                        if (action == "DISCONNECT") {
-                            shouldTerminate = true;
-                            isConnected = false;
-                            return false;
-                        }
-
-                    std::cout << action << std::endl;
-                    pendingReceipts.erase(rId);
-                    }
-                }
-                catch (const std::exception& e){}
-            }
+        }
     }
     return true;
-}
\ No newline at end of file
+}
@@ -1,39 +1,297 @@
 #include "../include/event.h"
 #include "../include/json.hpp"
+#include "../include/FrameView.h"
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <map>
 #include <vector>
 #include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 using json = nlohmann::json;
 
+UpdateList::UpdateList() : entries()
+{
+}
+
+UpdateList::UpdateList(const std::map<std::string, std::string> &updates) : entries(updates.begin(), updates.end())
+{
+    // the map is already sorted by key
+}
+
+void UpdateList::set(std::string_view key, std::string_view value)
+{
+    auto it = std::lower_bound(entries.begin(), entries.end(), key,
+                               [](const Entry &entry, std::string_view k) { return entry.first < k; });
+    if (it != entries.end() && it->first == key)
+        it->second.assign(value.data(), value.size());
+    else
+        entries.emplace(it, std::string(key), std::string(value));
+}
+
+void UpdateList::reserve(size_t count)
+{
+    entries.reserve(count);
+}
+
+const std::string *UpdateList::find(std::string_view key) const
+{
+    auto it = std::lower_bound(entries.begin(), entries.end(), key,
+                               [](const Entry &entry, std::string_view k) { return entry.first < k; });
+    if (it != entries.end() && it->first == key)
+        return &it->second;
+    return nullptr;
+}
+
+size_t UpdateList::size() const
+{
+    return entries.size();
+}
+
+bool UpdateList::empty() const
+{
+    return entries.empty();
+}
+
+void UpdateList::clear()
+{
+    entries.clear();
+}
+
+UpdateList::const_iterator UpdateList::begin() const
+{
+    return const_iterator(entries.begin());
+}
+
+UpdateList::const_iterator UpdateList::end() const
+{
+    return const_iterator(entries.end());
+}
+
+// An Event's block starts with the end offsets (uint32_t, from the start of the block) of its
+// seven fields, which follow back to back: team a, team b, event name, description, then the
+// general, team a and team b update lists. Each update is its key length and value length
+// (uint32_t each) followed by the key and value bytes.
+static const int FIELD_COUNT = 7;
+static const size_t BLOCK_HEADER = FIELD_COUNT * sizeof(uint32_t);
+
+static uint32_t readLength(const char *at)
+{
+    uint32_t length;
+    std::memcpy(&length, at, sizeof(length));
+    return length;
+}
+
+static void appendLength(std::string &out, size_t length)
+{
+    uint32_t value = static_cast<uint32_t>(length);
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+UpdateListView::UpdateListView(const char *first, const char *last) : first(first), last(last)
+{
+}
+
+std::pair<std::string_view, std::string_view> UpdateListView::const_iterator::operator*() const
+{
+    uint32_t keyLength = readLength(at);
+    uint32_t valueLength = readLength(at + sizeof(uint32_t));
+    const char *key = at + 2 * sizeof(uint32_t);
+    return {std::string_view(key, keyLength), std::string_view(key + keyLength, valueLength)};
+}
+
+UpdateListView::const_iterator &UpdateListView::const_iterator::operator++()
+{
+    at += 2 * sizeof(uint32_t) + readLength(at) + readLength(at + sizeof(uint32_t));
+    return *this;
+}
+
+bool UpdateListView::empty() const
+{
+    return first == last;
+}
+
+UpdateListView::const_iterator UpdateListView::begin() const
+{
+    return const_iterator(first);
+}
+
+UpdateListView::const_iterator UpdateListView::end() const
+{
+    return const_iterator(last);
+}
+
+namespace
+{
+// Lays out an Event's block in a buffer each thread reuses, then copies it out at its exact size.
+class BlockBuilder
+{
+private:
+    std::string &buffer;
+    int fields;
+
+    static std::string &threadBuffer()
+    {
+        thread_local std::string buffer;
+        return buffer;
+    }
+
+    void endField()
+    {
+        uint32_t end = static_cast<uint32_t>(buffer.size());
+        std::memcpy(&buffer[fields * sizeof(uint32_t)], &end, sizeof(end));
+        fields++;
+    }
+
+public:
+    BlockBuilder() : buffer(threadBuffer()), fields(0)
+    {
+        buffer.assign(BLOCK_HEADER, '\0');
+    }
+
+    BlockBuilder(const BlockBuilder &) = delete;
+    BlockBuilder &operator=(const BlockBuilder &) = delete;
+
+    void text(std::string_view s)
+    {
+        buffer.append(s.data(), s.size());
+        endField();
+    }
+
+    void update(std::string_view key, std::string_view value)
+    {
+        appendLength(buffer, key.size());
+        appendLength(buffer, value.size());
+        buffer.append(key.data(), key.size());
+        buffer.append(value.data(), value.size());
+    }
+
+    template <class List>
+    void updates(const List &list)
+    {
+        for (auto const &[key, value] : list)
+            update(key, value);
+        endField();
+    }
+
+    // the "key:value" lines of one update section of a report body
+    void updateLines(std::string_view section)
+    {
+        size_t pos = 0;
+        while (pos < section.size())
+        {
+            size_t end = section.find('\n', pos);
+            if (end == std::string_view::npos)
+                end = section.size();
+            std::string_view line = trimCR(section.substr(pos, end - pos));
+            size_t colon = line.find(':');
+            if (colon != std::string_view::npos)
+                update(line.substr(0, colon), line.substr(colon + 1));
+            pos = end + 1;
+        }
+        endField();
+    }
+
+    std::unique_ptr<char[]> finish() const
+    {
+        std::unique_ptr<char[]> block(new char[buffer.size()]);
+        std::memcpy(block.get(), buffer.data(), buffer.size());
+        return block;
+    }
+};
+
+template <class List>
+std::unique_ptr<char[]> buildBlock(std::string_view team_a_name, std::string_view team_b_name, std::string_view name,
+                                   std::string_view description, const List &game_updates,
+                                   const List &team_a_updates, const List &team_b_updates)
+{
+    BlockBuilder block;
+    block.text(team_a_name);
+    block.text(team_b_name);
+    block.text(name);
+    block.text(description);
+    block.updates(game_updates);
+    block.updates(team_a_updates);
+    block.updates(team_b_updates);
+    return block.finish();
+}
+}
+
 Event::Event(std::string team_a_name, std::string team_b_name, std::string name, int time,
              std::map<std::string, std::string> game_updates, std::map<std::string, std::string> team_a_updates,
              std::map<std::string, std::string> team_b_updates, std::string discription)
-    : team_a_name(team_a_name), team_b_name(team_b_name), name(name),
-      time(time), game_updates(game_updates), team_a_updates(team_a_updates),
-      team_b_updates(team_b_updates), description(discription)
+    : time(time), data(buildBlock(team_a_name, team_b_name, name, discription, game_updates, team_a_updates,
+                                  team_b_updates))
+{
+}
+
+Event::Event(std::string_view team_a_name, std::string_view team_b_name, std::string_view name, int time,
+             const UpdateList &game_updates, const UpdateList &team_a_updates, const UpdateList &team_b_updates,
+             std::string_view discription)
+    : time(time), data(buildBlock(team_a_name, team_b_name, name, discription, game_updates, team_a_updates,
+                                  team_b_updates))
+{
+}
+
+Event::Event(std::string_view team_a_name, std::string_view team_b_name, std::string_view name, int time,
+             const UpdateListView &game_updates, const UpdateListView &team_a_updates,
+             const UpdateListView &team_b_updates, std::string_view discription)
+    : time(time), data(buildBlock(team_a_name, team_b_name, name, discription, game_updates, team_a_updates,
+                                  team_b_updates))
 {
 }
 
+Event::Event(const Event &other) : time(other.time), data()
+{
+    *this = other;
+}
+
+Event &Event::operator=(const Event &other)
+{
+    if (this == &other)
+        return *this;
+    time = other.time;
+    if (other.data == nullptr)
+    {
+        data.reset();
+        return *this;
+    }
+    size_t size = other.heap_bytes();
+    data.reset(new char[size]);
+    std::memcpy(data.get(), other.data.get(), size);
+    return *this;
+}
+
 Event::~Event()
 {
 }
 
-const std::string &Event::get_team_a_name() const
+std::string_view Event::field(int index) const
+{
+    size_t begin = index == 0 ? BLOCK_HEADER : readLength(data.get() + (index - 1) * sizeof(uint32_t));
+    size_t end = readLength(data.get() + index * sizeof(uint32_t));
+    return std::string_view(data.get() + begin, end - begin);
+}
+
+std::string_view Event::get_team_a_name() const
 {
-    return this->team_a_name;
+    return field(0);
 }
 
-const std::string &Event::get_team_b_name() const
+std::string_view Event::get_team_b_name() const
 {
-    return this->team_b_name;
+    return field(1);
 }
 
-const std::string &Event::get_name() const
+std::string_view Event::get_name() const
 {
-    return this->name;
+    return field(2);
 }
 
 int Event::get_time() const
@@ -41,75 +299,351 @@ int Event::get_time() const
     return this->time;
 }
 
-const std::map<std::string, std::string> &Event::get_game_updates() const
+std::string_view Event::get_discription() const
 {
-    return this->game_updates;
+    return field(3);
 }
 
-const std::map<std::string, std::string> &Event::get_team_a_updates() const
+UpdateListView Event::get_game_updates() const
 {
-    return this->team_a_updates;
+    std::string_view updates = field(4);
+    return UpdateListView(updates.data(), updates.data() + updates.size());
 }
 
-const std::map<std::string, std::string> &Event::get_team_b_updates() const
+UpdateListView Event::get_team_a_updates() const
 {
-    return this->team_b_updates;
+    std::string_view updates = field(5);
+    return UpdateListView(updates.data(), updates.data() + updates.size());
 }
 
-const std::string &Event::get_discription() const
+UpdateListView Event::get_team_b_updates() const
 {
-    return this->description;
+    std::string_view updates = field(6);
+    return UpdateListView(updates.data(), updates.data() + updates.size());
 }
 
-Event::Event(const std::string &frame_body) : team_a_name(""), team_b_name(""), name(""), time(0), game_updates(), team_a_updates(), team_b_updates(), description("")
+size_t Event::heap_bytes() const
 {
+    return data == nullptr ? 0 : readLength(data.get() + (FIELD_COUNT - 1) * sizeof(uint32_t));
 }
 
-names_and_events parseEventsFile(std::string json_path)
+Event::Event(const std::string &frame_body) : Event(ReportBodyView(frame_body))
+{
+}
+
+Event::Event(const ReportBodyView &body) : time(body.time), data()
 {
-    std::ifstream f(json_path);
-    json data = json::parse(f);
+    // the frame delimiter leaves a line break after the description
+    std::string_view text = body.description;
+    while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+        text.remove_suffix(1);
+    BlockBuilder block;
+    block.text(body.team_a);
+    block.text(body.team_b);
+    block.text(body.event_name);
+    block.text(text);
+    block.updateLines(body.general_updates);
+    block.updateLines(body.team_a_updates);
+    block.updateLines(body.team_b_updates);
+    data = block.finish();
+}
 
-    std::string team_a_name = data["team a"];
-    std::string team_b_name = data["team b"];
+namespace
+{
+// Read-only private mapping of a whole file, unmapped on destruction.
+// data() is nullptr if the file could not be mapped (missing, empty, not a regular file).
+class MappedFile
+{
+private:
+    const char *begin;
+    size_t length;
 
-    // run over all the events and convert them to Event objects
-    std::vector<Event> events;
-    for (auto &event : data["events"])
-    {
-        std::string name = event["event name"];
-        int time = event["time"];
-        std::string description = event["description"];
-        std::map<std::string, std::string> game_updates;
-        std::map<std::string, std::string> team_a_updates;
-        std::map<std::string, std::string> team_b_updates;
-        for (auto &update : event["general game updates"].items())
+public:
+    explicit MappedFile(const std::string &path) : begin(nullptr), length(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
         {
-            if (update.value().is_string())
-                game_updates[update.key()] = update.value();
-            else
-                game_updates[update.key()] = update.value().dump();
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                begin = static_cast<const char *>(addr);
+                length = st.st_size;
+                // the parser walks the file once front to back
+                madvise(addr, length, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (begin != nullptr)
+            munmap(const_cast<char *>(begin), length);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return begin; }
+    size_t size() const { return length; }
+};
+
+// SAX handler that builds one Event at a time out of an events file.
+// Depth 1 is the root object, 2 the "events" array, 3 a single event and 4 one of its update maps.
+class EventsSaxHandler : public nlohmann::json_sax<json>
+{
+private:
+    const std::function<bool(const Event &)> &on_event;
+    std::string team_a_name;
+    std::string team_b_name;
+    bool seen_team_a;
+    bool seen_team_b;
+    bool in_events;
+    int depth;
+    std::string key_name;
+    // fields of the event currently being parsed
+    std::string name;
+    int time;
+    std::string description;
+    UpdateList game_updates;
+    UpdateList team_a_updates;
+    UpdateList team_b_updates;
+    UpdateList *current_updates;
+    // events seen before both team names were known
+    std::vector<Event> pending;
+    // objects/arrays used as update values are rebuilt here and stored as their dump()
+    json nested_value;
+    std::vector<json *> nested_stack;
+    std::string nested_key;
+
+    bool emit(Event event)
+    {
+        if (!seen_team_a || !seen_team_b)
+        {
+            pending.push_back(std::move(event));
+            return true;
+        }
+        return on_event(event);
+    }
+
+    bool flush_pending()
+    {
+        for (Event &event : pending)
+        {
+            Event named(team_a_name, team_b_name, event.get_name(), event.get_time(), event.get_game_updates(),
+                        event.get_team_a_updates(), event.get_team_b_updates(), event.get_discription());
+            if (!on_event(named))
+                return false;
         }
+        pending.clear();
+        return true;
+    }
 
-        for (auto &update : event["team a updates"].items())
+    bool value(json v)
+    {
+        if (!nested_stack.empty())
         {
-            if (update.value().is_string())
-                team_a_updates[update.key()] = update.value();
+            json &top = *nested_stack.back();
+            if (top.is_array())
+                top.push_back(v);
             else
-                team_a_updates[update.key()] = update.value().dump();
+                top[key_name] = v;
+        }
+        else if (depth == 1)
+        {
+            if (key_name == "team a" && v.is_string())
+            {
+                team_a_name = v.get<std::string>();
+                seen_team_a = true;
+            }
+            else if (key_name == "team b" && v.is_string())
+            {
+                team_b_name = v.get<std::string>();
+                seen_team_b = true;
+            }
+        }
+        else if (depth == 3 && in_events)
+        {
+            if (key_name == "event name" && v.is_string())
+                name = v.get<std::string>();
+            else if (key_name == "time" && v.is_number())
+                time = v.get<int>();
+            else if (key_name == "description" && v.is_string())
+                description = v.get<std::string>();
+        }
+        else if (depth == 4 && current_updates != nullptr)
+        {
+            current_updates->set(key_name, v.is_string() ? v.get<std::string>() : v.dump());
         }
+        return true;
+    }
 
-        for (auto &update : event["team b updates"].items())
+    bool start_nested(json container)
+    {
+        if (nested_stack.empty())
         {
-            if (update.value().is_string())
-                team_b_updates[update.key()] = update.value();
+            nested_key = key_name;
+            nested_value = container;
+            nested_stack.push_back(&nested_value);
+        }
+        else
+        {
+            json &top = *nested_stack.back();
+            if (top.is_array())
+            {
+                top.push_back(container);
+                nested_stack.push_back(&top.back());
+            }
             else
-                team_b_updates[update.key()] = update.value().dump();
+            {
+                top[key_name] = container;
+                nested_stack.push_back(&top[key_name]);
+            }
+        }
+        return true;
+    }
+
+    bool end_nested()
+    {
+        nested_stack.pop_back();
+        if (nested_stack.empty())
+            current_updates->set(nested_key, nested_value.dump());
+        return true;
+    }
+
+public:
+    explicit EventsSaxHandler(const std::function<bool(const Event &)> &on_event)
+        : on_event(on_event), team_a_name(""), team_b_name(""), seen_team_a(false), seen_team_b(false),
+          in_events(false), depth(0), key_name(""), name(""), time(0), description(""), game_updates(),
+          team_a_updates(), team_b_updates(), current_updates(nullptr), pending(), nested_value(),
+          nested_stack(), nested_key("")
+    {
+    }
+
+    EventsSaxHandler(const EventsSaxHandler &) = delete;
+    EventsSaxHandler &operator=(const EventsSaxHandler &) = delete;
+
+    const std::string &get_team_a_name() const { return team_a_name; }
+    const std::string &get_team_b_name() const { return team_b_name; }
+
+    bool null() override { return value(json()); }
+    bool boolean(bool val) override { return value(val); }
+    bool number_integer(number_integer_t val) override { return value(val); }
+    bool number_unsigned(number_unsigned_t val) override { return value(val); }
+    bool number_float(number_float_t val, const string_t &) override { return value(val); }
+    bool string(string_t &val) override { return value(std::move(val)); }
+    bool binary(binary_t &) override { return true; }
+
+    bool key(string_t &val) override
+    {
+        key_name = val;
+        return true;
+    }
+
+    bool start_object(std::size_t) override
+    {
+        if (!nested_stack.empty() || (depth == 4 && current_updates != nullptr))
+            return start_nested(json::object());
+        depth++;
+        if (depth == 3 && in_events)
+        {
+            name = "";
+            time = 0;
+            description = "";
+            game_updates.clear();
+            team_a_updates.clear();
+            team_b_updates.clear();
         }
-        
-        events.push_back(Event(team_a_name, team_b_name, name, time, game_updates, team_a_updates, team_b_updates, description));
+        else if (depth == 4 && in_events)
+        {
+            if (key_name == "general game updates")
+                current_updates = &game_updates;
+            else if (key_name == "team a updates")
+                current_updates = &team_a_updates;
+            else if (key_name == "team b updates")
+                current_updates = &team_b_updates;
+        }
+        return true;
+    }
+
+    bool end_object() override
+    {
+        if (!nested_stack.empty())
+            return end_nested();
+        bool keep_going = true;
+        if (depth == 4)
+            current_updates = nullptr;
+        else if (depth == 3 && in_events)
+            keep_going = emit(Event(team_a_name, team_b_name, name, time, game_updates, team_a_updates,
+                                    team_b_updates, description));
+        else if (depth == 1)
+            keep_going = flush_pending();
+        depth--;
+        return keep_going;
     }
-    names_and_events events_and_names{team_a_name, team_b_name, events};
+
+    bool start_array(std::size_t) override
+    {
+        if (!nested_stack.empty() || (depth == 4 && current_updates != nullptr))
+            return start_nested(json::array());
+        depth++;
+        if (depth == 2 && key_name == "events")
+            in_events = true;
+        return true;
+    }
+
+    bool end_array() override
+    {
+        if (!nested_stack.empty())
+            return end_nested();
+        if (depth == 2)
+            in_events = false;
+        depth--;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex) override
+    {
+        throw std::runtime_error(ex.what());
+    }
+};
+}
+
+names_and_events streamEventsFile(std::string json_path, const std::function<bool(const Event &)> &on_event)
+{
+    EventsSaxHandler handler(on_event);
+
+    // parse straight out of the page cache when the file can be mapped
+    MappedFile mapped(json_path);
+    if (mapped.data() != nullptr)
+    {
+        json::sax_parse(mapped.data(), mapped.data() + mapped.size(), &handler);
+    }
+    else
+    {
+        std::ifstream f(json_path);
+        if (!f.is_open())
+            throw std::runtime_error("cannot open " + json_path);
+        json::sax_parse(f, &handler);
+    }
+
+    names_and_events names{handler.get_team_a_name(), handler.get_team_b_name(), {}};
+    return names;
+}
+
+names_and_events parseEventsFile(std::string json_path)
+{
+    // run over all the events and collect them as Event objects
+    std::vector<Event> events;
+    names_and_events events_and_names = streamEventsFile(json_path, [&events](const Event &event) {
+        events.push_back(event);
+        return true;
+    });
+    events_and_names.events = std::move(events);
 
     return events_and_names;
-}
\ No newline at end of file
+}
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include "../include/ConnectionHandler.h"
+
+/**
+* Measures how many read syscalls the client needs per received frame.
+* A local thread plays the server and streams MESSAGE-like frames over loopback,
+* the client reads them back once byte-by-byte (the old getFrameAscii path) and once
+* through the buffered getFrameAscii.
+*/
+
+static std::string sampleFrame() {
+    return "MESSAGE\n"
+           "subscription:0\n"
+           "message-id:1\n"
+           "destination:Germany_Japan\n"
+           "\n"
+           "user:bench\n"
+           "team a:Germany\n"
+           "team b:Japan\n"
+           "event name:goal!!!!\n"
+           "time:1200\n"
+           "general game updates:\n"
+           "team a updates:\n"
+           "goals:1\n"
+           "team b updates:\n"
+           "description:\n"
+           "Germany take the lead after a long spell of pressure.\n";
+}
+
+// Accept one connection on the given acceptor and write `count` frames to it.
+static void serveFrames(tcp::acceptor &acceptor, int count) {
+    tcp::socket peer(acceptor.get_executor());
+    acceptor.accept(peer);
+    std::string frame = sampleFrame();
+    frame.push_back('\0');
+    std::string all;
+    for (int i = 0; i < count; i++)
+        all += frame;
+    boost::asio::write(peer, boost::asio::buffer(all));
+    peer.shutdown(tcp::socket::shutdown_send);
+}
+
+// Old receive path: one getBytes call per byte.
+static bool readFrameBytewise(ConnectionHandler &handler, std::string &frame) {
+    char ch;
+    do {
+        if (!handler.getBytes(&ch, 1))
+            return false;
+        if (ch != '\0')
+            frame.append(1, ch);
+    } while (ch != '\0');
+    return true;
+}
+
+static void runOnce(const char *label, bool bytewise, int count) {
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    short port = acceptor.local_endpoint().port();
+    std::thread server(serveFrames, std::ref(acceptor), count);
+
+    ConnectionHandler handler("127.0.0.1", port);
+    if (!handler.connect()) {
+        server.join();
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    int frames = 0;
+    for (; frames < count; frames++) {
+        std::string frame;
+        bool ok = bytewise ? readFrameBytewise(handler, frame) : handler.getFrameAscii(frame, '\0');
+        if (!ok)
+            break;
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    server.join();
+
+    std::cout << label << ": " << frames << " frames, "
+              << handler.getReadCalls() << " read calls, "
+              << (frames ? (double) handler.getReadCalls() / frames : 0.0) << " syscalls/frame, "
+              << (elapsed > 0 ? frames / elapsed : 0.0) << " frames/sec" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    runOnce("byte-at-a-time", true, count);
+    runOnce("buffered", false, count);
+    return 0;
+}
@@ -23,6 +23,7 @@ public class ConnectionsImpl<T> implements Connections<T>{
     }
 
     //changed some of the logic here! 
+    // msg holds any extra headers for the MESSAGE frame, then the blank line and the body.
     @Override
     public void send(String channel, T msg) {
         ConcurrentHashMap<Integer, Integer> subs = channelSubscribers.get(channel);
@@ -32,8 +33,7 @@ public class ConnectionsImpl<T> implements Connections<T>{
                 String finalMsg = "MESSAGE\n" +
                               "subscription:" + subId + "\n" +
                               "message-id:" + messageIdCounter.incrementAndGet() + "\n" +
-                              "destination:" + channel + "\n" 
-                              +"\n" +
+                              "destination:" + channel + "\n" +
                               msg; 
                 @SuppressWarnings("unchecked")
                 T msgToSend = (T)finalMsg; // sorry it annoyed Tair so much. We know it's a String so we can cast it 
@@ -1,28 +1,84 @@
 package bgu.spl.net.impl.stomp;
 
 import bgu.spl.net.api.MessageEncoderDecoder;
+import java.nio.ByteBuffer;
 import java.nio.charset.StandardCharsets;
 import java.util.Arrays;
 
 public class StompMessageEncoderDecoder implements MessageEncoderDecoder<String>{
 
+    // Frames longer than this are rejected in length-prefixed mode.
+    private static final int MAX_FRAME_LENGTH = 16 << 20;
+
     private byte[] bytes = new byte[1 << 10]; //1 KB
     private int len = 0;
 
+    // Frames are '\0' terminated until a CONNECTED frame agreeing to "framing:length" is encoded.
+    // From then on every frame in both directions is a 4-byte big-endian length followed by
+    // exactly that many bytes, so nothing has to be compared byte by byte.
+    private volatile boolean lengthFraming = false;
+    private int prefixBytes = 0;
+    private int frameLength = 0;
+
     @Override
     public String decodeNextByte(byte nextByte) {
+        if (lengthFraming) {
+            return decodeLengthPrefixed(nextByte);
+        }
         if(nextByte == '\0'){
             return getStringFromBytes();
         }
+        // A bare end of line between frames is a heart-beat, not the start of a command.
+        if(len == 0 && (nextByte == '\n' || nextByte == '\r')){
+            return null;
+        }
         addByte(nextByte);
         return null;
     }
 
     @Override
     public byte[] encode(String message) {
-        return (message + '\0').getBytes(StandardCharsets.UTF_8);
+        if (lengthFraming) {
+            byte[] frame = message.getBytes(StandardCharsets.UTF_8);
+            return ByteBuffer.allocate(4 + frame.length).putInt(frame.length).put(frame).array();
+        }
+        byte[] encoded = (message + '\0').getBytes(StandardCharsets.UTF_8);
+        if (message.startsWith("CONNECTED\n") && message.contains("\nframing:length\n")) {
+            lengthFraming = true;
+        }
+        return encoded;
     }
-    
+
+    private String decodeLengthPrefixed(byte nextByte) {
+        if (prefixBytes < 4) {
+            frameLength = (frameLength << 8) | (nextByte & 0xff);
+            prefixBytes++;
+            if (prefixBytes < 4) {
+                return null;
+            }
+            if (frameLength < 0 || frameLength > MAX_FRAME_LENGTH) {
+                throw new IllegalArgumentException("Frame length " + frameLength + " out of range");
+            }
+            if (bytes.length < frameLength) {
+                bytes = new byte[frameLength];
+            }
+            len = 0;
+            // An empty frame is a heart-beat and is not passed on.
+            if (frameLength == 0) {
+                prefixBytes = 0;
+            }
+            return null;
+        }
+        bytes[len++] = nextByte;
+        return len == frameLength ? finishLengthPrefixed() : null;
+    }
+
+    private String finishLengthPrefixed() {
+        prefixBytes = 0;
+        frameLength = 0;
+        return getStringFromBytes();
+    }
+
     private void addByte(byte nextByte){
         if(len >= bytes.length){
             bytes = Arrays.copyOf(bytes, len * 2);
@@ -36,5 +92,5 @@ public class StompMessageEncoderDecoder implements MessageEncoderDecoder<String>
         len = 0;
         return result;
     }
-    
+
 }
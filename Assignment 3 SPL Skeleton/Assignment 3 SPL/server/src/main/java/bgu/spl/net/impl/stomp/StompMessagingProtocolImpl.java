@@ -5,14 +5,12 @@ import bgu.spl.net.srv.Connections;
 import bgu.spl.net.srv.DatabaseService;
 import java.util.HashMap;
 import java.util.Map;
-import java.util.concurrent.atomic.AtomicInteger;
 
 public class StompMessagingProtocolImpl implements StompMessagingProtocol<String>{
 
     private int connectionId;
     private Connections<String> connections;
     private boolean shouldTerminate = false;
-    private static final AtomicInteger messageIdCounter = new AtomicInteger(0);
     private HashMap<String, String> topics = new HashMap<>();
     private boolean isLoggedIn = false;
     private DatabaseService db;
@@ -148,7 +146,10 @@ public class StompMessagingProtocolImpl implements StompMessagingProtocol<String
             currentUsername = login;
 
             System.out.println("DEBUG: Connection authorized. Sending CONNECTED...");
-            connections.send(connectionId, "CONNECTED\nversion:1.2\n\n");
+            // A client asking for length-prefixed framing gets it; StompMessageEncoderDecoder
+            // switches over once this CONNECTED frame has been encoded.
+            String framing = "length".equals(headers.get("framing")) ? "framing:length\n" : "";
+            connections.send(connectionId, "CONNECTED\nversion:1.2\n" + framing + "\n");
         }
     }
 
@@ -196,8 +197,10 @@ public class StompMessagingProtocolImpl implements StompMessagingProtocol<String
                            currentUsername + "', '" + safeBody + "', " + now + ")";
         db.execute(reportCmd);
 
-        String messageFrame = "message-id:" + messageIdCounter.incrementAndGet() + "\n" +
-                              "destination:" + dest + "\n" +
+        // ConnectionsImpl adds subscription, message-id and destination per subscriber.
+        // A compressed body is passed through untouched, its content-encoding travels with it.
+        String encoding = headers.get("content-encoding");
+        String messageFrame = (encoding != null ? "content-encoding:" + encoding + "\n" : "") +
                               "\n" +
                               body;
 